@@ -21,6 +21,7 @@
 #include <libavutil/log.h>
 #include <libavcodec/avcodec.h>
 
+#include "config.h"
 #include "common/common.h"
 #include "common/msg.h"
 #include "demux/packet.h"
@@ -111,6 +112,14 @@ void mp_set_av_packet(AVPacket *dst, struct demux_packet *mpkt, AVRational *tb)
     if (mpkt && mpkt->avpacket) {
         dst->side_data = mpkt->avpacket->side_data;
         dst->side_data_elems = mpkt->avpacket->side_data_elems;
+#if HAVE_AVUTIL_REFCOUNTING
+        // Let decoders reference the data instead of copying it. (Only if the
+        // packet is fully contained in the buffer.)
+        AVBufferRef *buf = mpkt->avpacket->buf;
+        if (buf && dst->data >= buf->data &&
+            dst->data + dst->size <= buf->data + buf->size)
+            dst->buf = buf;
+#endif
     }
     if (mpkt && tb && tb->num > 0 && tb->den > 0)
         dst->duration = mpkt->duration / av_q2d(*tb);
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -34,11 +35,15 @@
 #include "talloc.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "compat/atomics.h"
 
 #include "stream/stream.h"
 #include "demux.h"
+#include "packet_pool.h"
 #include "stheader.h"
 #include "mf.h"
+#include "osdep/timer.h"
+#include "options/path.h"
 
 #include "audio/format.h"
 
@@ -88,13 +93,48 @@ const demuxer_desc_t *const demuxer_list[] = {
     NULL
 };
 
+// The demuxer thread tries to keep at least this much data queued for each
+// selected audio and video stream, if the buffered duration is unknown.
+// Otherwise, --demuxer-readahead-secs is used.
+#define MIN_PACKS 32
+#define MIN_PACK_BYTES (1024 * 1024)
+// Buffered durations above this (or negative ones) are assumed to come from
+// broken or reordered timestamps, and are treated as unknown.
+#define MAX_BUFFERED_SECS 60.0
+
+// State for the optional demuxer thread (demux_start_thread()). If the thread
+// is running, it owns the demuxer implementation: the main thread may call
+// into it (demux_seek(), demux_control() etc.) only while the thread is
+// paused with demux_pause(). The packet queues are protected by the lock.
+struct demux_internal {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_t thread;
+
+    bool threading;         // thread is running
+    bool thread_terminate;
+    int pause_count;        // demux_pause() nesting level
+    bool thread_paused;     // thread is waiting, and not using the demuxer
+    bool eof;               // demuxer returned EOF (cleared on seek)
+};
+
+// Packet queue; protected by demux_internal.lock.
+// The list head..tail contains the back buffer (packets already returned by
+// demux_read_packet(), kept for seeking with --demuxer-back-buffer), followed
+// by the packets not read yet, starting with reader.
 struct demux_stream {
     int selected;          // user wants packets from this stream
     int eof;               // end of demuxed stream? (true if all buffer empty)
-    int packs;            // number of packets in buffer
-    int bytes;            // total bytes of packets in buffer
+    int packs;            // number of packets in buffer (not read yet)
+    int bytes;            // total bytes of packets in buffer (not read yet)
+    bool waiting;          // a reader is waiting for packets (threading only)
+    int back_packs;        // number of packets in the back buffer
+    int64_t back_bytes;    // total bytes of packets in the back buffer
+    double last_read_pts;  // timestamp of the last packet read
+    double last_ts;        // highest timestamp of the queued packets
     struct demux_packet *head;
     struct demux_packet *tail;
+    struct demux_packet *reader; // next packet to return
 };
 
 static void add_stream_chapters(struct demuxer *demuxer);
@@ -107,17 +147,73 @@ static void ds_free_packs(struct demux_stream *ds)
         free_demux_packet(dp);
         dp = dn;
     }
-    ds->head = ds->tail = NULL;
+    ds->head = ds->tail = ds->reader = NULL;
     ds->packs = 0; // !!!!!
     ds->bytes = 0;
+    ds->back_packs = 0;
+    ds->back_bytes = 0;
+    ds->last_read_pts = MP_NOPTS_VALUE;
+    ds->last_ts = MP_NOPTS_VALUE;
     ds->eof = 0;
 }
 
+static double packet_time(struct demux_packet *dp)
+{
+    return dp->pts != MP_NOPTS_VALUE ? dp->pts : dp->dts;
+}
+
+// Timestamp of the read position, or MP_NOPTS_VALUE. Called with lock held.
+static double ds_reader_time(struct demux_stream *ds)
+{
+    double start = ds->reader ? packet_time(ds->reader) : MP_NOPTS_VALUE;
+    return start != MP_NOPTS_VALUE ? start : ds->last_read_pts;
+}
+
+// Duration of the packets queued ahead of the reader in seconds, or -1 if
+// unknown. Called with lock held.
+static double ds_buffered_secs(struct demux_stream *ds)
+{
+    if (!ds->reader)
+        return 0;
+    double start = ds_reader_time(ds);
+    if (start == MP_NOPTS_VALUE || ds->last_ts == MP_NOPTS_VALUE)
+        return -1;
+    double secs = ds->last_ts - start;
+    if (secs < 0 || secs > MAX_BUFFERED_SECS)
+        return -1;
+    return secs;
+}
+
+// Drop packets from the start of the back buffer until it fits into the
+// configured limits (or all of them if the back buffer is disabled).
+static void ds_prune_back_buffer(struct demuxer *demuxer,
+                                 struct demux_stream *ds)
+{
+    struct MPOpts *opts = demuxer->opts;
+    int64_t max_bytes = opts->demuxer_back_buffer * 1024LL;
+    double max_secs = opts->demuxer_back_buffer_secs;
+    while (ds->back_packs > 0) {
+        struct demux_packet *dp = ds->head;
+        double t = packet_time(dp);
+        bool too_old = t != MP_NOPTS_VALUE &&
+                       ds->last_read_pts != MP_NOPTS_VALUE &&
+                       ds->last_read_pts - t > max_secs;
+        if (max_bytes > 0 && ds->back_bytes <= max_bytes && !too_old)
+            break;
+        ds->head = dp->next;
+        ds->back_packs--;
+        ds->back_bytes -= dp->len;
+        free_demux_packet(dp);
+    }
+    if (!ds->head)
+        ds->tail = NULL;
+}
+
 static void packet_destroy(void *ptr)
 {
     struct demux_packet *dp = ptr;
     talloc_free(dp->avpacket);
-    free(dp->allocation);
+    packet_pool_free(dp->allocation);
 }
 
 static struct demux_packet *create_packet(size_t len)
@@ -143,11 +239,7 @@ static struct demux_packet *create_packet(size_t len)
 struct demux_packet *new_demux_packet(size_t len)
 {
     struct demux_packet *dp = create_packet(len);
-    dp->buffer = malloc(len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        fprintf(stderr, "Memory allocation failure!\n");
-        abort();
-    }
+    dp->buffer = packet_pool_alloc(len + MP_INPUT_BUFFER_PADDING_SIZE);
     memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
     dp->allocation = dp->buffer;
     return dp;
@@ -168,6 +260,51 @@ struct demux_packet *new_demux_packet_from(void *data, size_t len)
     return dp;
 }
 
+// Return a packet referencing a part of src's data, without copying. The
+// data doesn't necessarily have zero padding, but there's always at least
+// MP_INPUT_BUFFER_PADDING_SIZE bytes of readable memory after it. src must
+// have been allocated with new_demux_packet().
+struct demux_packet *new_demux_packet_ref(struct demux_packet *src,
+                                          void *data, size_t len)
+{
+    assert(src->allocation);
+    assert((unsigned char *)data >= src->buffer &&
+           (unsigned char *)data + len <= src->buffer + src->len);
+    struct demux_packet *dp = create_packet(len);
+    dp->buffer = data;
+    dp->allocation = packet_pool_ref(src->allocation);
+    return dp;
+}
+
+static void destroy_avpacket(void *pkt);
+
+// Return a packet referencing data, which must be within buf. A new reference
+// to buf is created, and the data is not copied. Like with
+// new_demux_packet_ref(), the data doesn't need to be padded, but there must
+// be MP_INPUT_BUFFER_PADDING_SIZE bytes of readable memory after it. Returns
+// NULL if not supported by the libavcodec version.
+struct demux_packet *new_demux_packet_from_avbuf(struct AVBufferRef *buf,
+                                                 void *data, size_t len)
+{
+#if HAVE_AVUTIL_REFCOUNTING
+    assert((uint8_t *)data >= buf->data &&
+           (uint8_t *)data + len <= buf->data + buf->size);
+    AVPacket *avpkt = talloc_zero(NULL, AVPacket);
+    talloc_set_destructor(avpkt, destroy_avpacket);
+    av_init_packet(avpkt);
+    avpkt->buf = av_buffer_ref(buf);
+    if (!avpkt->buf)
+        abort();
+    avpkt->data = data;
+    avpkt->size = len;
+    struct demux_packet *dp = new_demux_packet_fromdata(data, len);
+    dp->avpacket = avpkt;
+    return dp;
+#else
+    return NULL;
+#endif
+}
+
 void resize_demux_packet(struct demux_packet *dp, size_t len)
 {
     if (len > 1000000000) {
@@ -175,10 +312,14 @@ void resize_demux_packet(struct demux_packet *dp, size_t len)
         abort();
     }
     assert(dp->allocation);
-    dp->buffer = realloc(dp->buffer, len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        fprintf(stderr, "Memory allocation failure!\n");
-        abort();
+    size_t size = len + MP_INPUT_BUFFER_PADDING_SIZE;
+    if (size > packet_pool_capacity(dp->allocation) ||
+        dp->buffer != dp->allocation || packet_pool_is_shared(dp->allocation))
+    {
+        void *buffer = packet_pool_alloc(size);
+        memcpy(buffer, dp->buffer, MPMIN(dp->len, len));
+        packet_pool_free(dp->allocation);
+        dp->buffer = buffer;
     }
     memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
     dp->len = len;
@@ -195,6 +336,17 @@ static void destroy_avpacket(void *pkt)
     av_free_packet(pkt);
 }
 
+static void copy_packet_props(struct demux_packet *dst,
+                              struct demux_packet *src)
+{
+    dst->pts = src->pts;
+    dst->dts = src->dts;
+    dst->duration = src->duration;
+    dst->stream_pts = src->stream_pts;
+    dst->pos = src->pos;
+    dst->keyframe = src->keyframe;
+}
+
 struct demux_packet *demux_copy_packet(struct demux_packet *dp)
 {
     struct demux_packet *new = NULL;
@@ -216,10 +368,29 @@ struct demux_packet *demux_copy_packet(struct demux_packet *dp)
         new = new_demux_packet(dp->len);
         memcpy(new->buffer, dp->buffer, new->len);
     }
-    new->pts = dp->pts;
-    new->dts = dp->dts;
-    new->duration = dp->duration;
-    new->stream_pts = dp->stream_pts;
+    copy_packet_props(new, dp);
+    return new;
+}
+
+// Like demux_copy_packet(), but return a new reference to dp's data instead of
+// copying it, if possible. The data must not be modified afterwards.
+struct demux_packet *demux_ref_packet(struct demux_packet *dp)
+{
+    struct demux_packet *new = NULL;
+    if (dp->allocation)
+        new = new_demux_packet_ref(dp, dp->buffer, dp->len);
+#if HAVE_AVUTIL_REFCOUNTING
+    // Side data is not referenced by new_demux_packet_from_avbuf().
+    if (!new && dp->avpacket && dp->avpacket->buf &&
+        !dp->avpacket->side_data_elems)
+    {
+        new = new_demux_packet_from_avbuf(dp->avpacket->buf, dp->buffer,
+                                          dp->len);
+    }
+#endif
+    if (!new)
+        return demux_copy_packet(dp);
+    copy_packet_props(new, dp);
     return new;
 }
 
@@ -244,7 +415,8 @@ struct sh_stream *new_sh_stream(demuxer_t *demuxer, enum stream_type type)
         .demuxer_id = demuxer_id, // may be overwritten by demuxer
         .ds = talloc_zero(sh, struct demux_stream),
     };
-    MP_TARRAY_APPEND(demuxer, demuxer->streams, demuxer->num_streams, sh);
+    sh->ds->last_read_pts = MP_NOPTS_VALUE;
+    sh->ds->last_ts = MP_NOPTS_VALUE;
     switch (sh->type) {
         case STREAM_VIDEO: {
             struct sh_video *sht = talloc_zero(demuxer, struct sh_video);
@@ -266,6 +438,18 @@ struct sh_stream *new_sh_stream(demuxer_t *demuxer, enum stream_type type)
 
     sh->ds->selected = demuxer->stream_autoselect;
 
+    // The demuxer thread can add streams while the player is reading the
+    // stream list, so the array is never reallocated, and the pointer is
+    // stored before num_streams is incremented. The caller fills in the codec
+    // parameters after this returns, so the player must access new streams
+    // only while the thread is paused (see add_demuxer_tracks()).
+    if (!demuxer->streams)
+        demuxer->streams = talloc_array(demuxer, struct sh_stream *,
+                                        MAX_SH_STREAMS + 1);
+    demuxer->streams[demuxer->num_streams] = sh;
+    mp_memory_barrier();
+    demuxer->num_streams++;
+
     return sh;
 }
 
@@ -273,11 +457,14 @@ void free_demuxer(demuxer_t *demuxer)
 {
     if (!demuxer)
         return;
+    demux_stop_thread(demuxer);
     if (demuxer->desc->close)
         demuxer->desc->close(demuxer);
     // free streams:
     for (int n = 0; n < demuxer->num_streams; n++)
         ds_free_packs(demuxer->streams[n]->ds);
+    pthread_mutex_destroy(&demuxer->in->lock);
+    pthread_cond_destroy(&demuxer->in->wakeup);
     talloc_free(demuxer);
 }
 
@@ -311,8 +498,11 @@ static int count_bytes(struct demuxer *demux, enum stream_type type)
 int demuxer_add_packet(demuxer_t *demuxer, struct sh_stream *stream,
                        demux_packet_t *dp)
 {
+    struct demux_internal *in = demuxer->in;
+    pthread_mutex_lock(&in->lock);
     struct demux_stream *ds = stream ? stream->ds : NULL;
     if (!dp || !ds || !ds->selected) {
+        pthread_mutex_unlock(&in->lock);
         talloc_free(dp);
         return 0;
     }
@@ -321,6 +511,7 @@ int demuxer_add_packet(demuxer_t *demuxer, struct sh_stream *stream,
         /* Video packets with size 0 are assumed to not correspond to frames,
          * but to indicate the absence of a frame in formats like AVI
          * that must have packets at fixed timestamp intervals. */
+        pthread_mutex_unlock(&in->lock);
         talloc_free(dp);
         return 1;
     }
@@ -338,6 +529,8 @@ int demuxer_add_packet(demuxer_t *demuxer, struct sh_stream *stream,
         // first packet in stream
         ds->head = ds->tail = dp;
     }
+    if (!ds->reader)
+        ds->reader = dp;
     /* ds_get_packets() can set ds->eof to 1 when another stream runs out of
      * buffer space. That makes sense because in that situation the calling
      * code should not count on being able to demux more packets from this
@@ -354,10 +547,22 @@ int demuxer_add_packet(demuxer_t *demuxer, struct sh_stream *stream,
     if (stream->type != STREAM_VIDEO && dp->pts == MP_NOPTS_VALUE)
         dp->pts = dp->dts;
 
+    // A timestamp below the read position means the timestamps were reset
+    // (e.g. a discontinuity in a TS file), and the old maximum is stale.
+    double ts = packet_time(dp);
+    if (ts != MP_NOPTS_VALUE) {
+        double start = ds_reader_time(ds);
+        if (ds->last_ts == MP_NOPTS_VALUE || ts > ds->last_ts ||
+            (start != MP_NOPTS_VALUE && ts < start))
+            ds->last_ts = ts;
+    }
+
     MP_DBG(demuxer, "DEMUX: Append packet to %s, len=%d  pts=%5.3f  pos=%"PRIu64" "
            "[packs: A=%d V=%d S=%d]\n", stream_type_name(stream->type),
            dp->len, dp->pts, dp->pos, count_packs(demuxer, STREAM_AUDIO),
            count_packs(demuxer, STREAM_VIDEO), count_packs(demuxer, STREAM_SUB));
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
     return 1;
 }
 
@@ -395,21 +600,118 @@ static int demux_fill_buffer(demuxer_t *demux)
     return demux->desc->fill_buffer ? demux->desc->fill_buffer(demux) : 0;
 }
 
+// Whether the demuxer thread should read more packets. Called with lock held.
+static bool demux_needs_packets(demuxer_t *demux)
+{
+    double min_secs = demux->opts->demuxer_readahead_secs;
+    for (int n = 0; n < demux->num_streams; n++) {
+        struct sh_stream *sh = demux->streams[n];
+        struct demux_stream *ds = sh->ds;
+        if (!ds->selected)
+            continue;
+        if (ds->waiting)
+            return true;
+        // Subtitles can be sparse; they are only read on demand.
+        if (sh->type == STREAM_SUB)
+            continue;
+        double secs = min_secs > 0 ? ds_buffered_secs(ds) : -1;
+        if (secs >= 0) {
+            if (secs < min_secs)
+                return true;
+        } else if (ds->packs < MIN_PACKS && ds->bytes < MIN_PACK_BYTES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Return the minimum duration of the packets queued ahead over all selected
+// audio and video streams, or -1 if unknown.
+double demux_get_buffered_secs(struct demuxer *demuxer)
+{
+    struct demux_internal *in = demuxer->in;
+    double res = -1;
+    pthread_mutex_lock(&in->lock);
+    for (int n = 0; n < demuxer->num_streams; n++) {
+        struct sh_stream *sh = demuxer->streams[n];
+        if (!sh->ds->selected || sh->type == STREAM_SUB)
+            continue;
+        double secs = ds_buffered_secs(sh->ds);
+        if (secs < 0) {
+            res = -1;
+            break;
+        }
+        res = res < 0 ? secs : MPMIN(res, secs);
+    }
+    pthread_mutex_unlock(&in->lock);
+    return res;
+}
+
+static void *demux_thread(void *pctx)
+{
+    struct demuxer *demux = pctx;
+    struct demux_internal *in = demux->in;
+    pthread_mutex_lock(&in->lock);
+    while (!in->thread_terminate) {
+        in->thread_paused = in->pause_count > 0;
+        if (in->thread_paused) {
+            pthread_cond_broadcast(&in->wakeup);
+            pthread_cond_wait(&in->wakeup, &in->lock);
+            continue;
+        }
+        if (in->eof || !demux_needs_packets(demux) ||
+            demux_check_queue_full(demux))
+        {
+            pthread_cond_broadcast(&in->wakeup);
+            pthread_cond_wait(&in->wakeup, &in->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&in->lock);
+        bool eof = !demux_fill_buffer(demux);
+        pthread_mutex_lock(&in->lock);
+        if (eof) {
+            MP_VERBOSE(demux, "Demuxer thread: EOF reached.\n");
+            in->eof = true;
+        }
+        pthread_cond_broadcast(&in->wakeup);
+    }
+    in->thread_paused = true;
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
+    return NULL;
+}
+
+// Called with lock held.
 static void ds_get_packets(struct sh_stream *sh)
 {
     struct demux_stream *ds = sh->ds;
     demuxer_t *demux = sh->demuxer;
+    struct demux_internal *in = demux->in;
     MP_TRACE(demux, "ds_get_packets (%s) called\n",
              stream_type_name(sh->type));
+    // If the thread is paused, the caller owns the demuxer; read directly.
+    bool threaded = in->threading && !in->pause_count;
     while (1) {
-        if (ds->head)
+        if (ds->reader)
             return;
 
         if (demux_check_queue_full(demux))
             break;
 
-        if (!demux_fill_buffer(demux))
-            break; // EOF
+        if (threaded) {
+            if (in->eof)
+                break;
+            ds->waiting = true;
+            pthread_cond_broadcast(&in->wakeup);
+            pthread_cond_wait(&in->wakeup, &in->lock);
+            ds->waiting = false;
+        } else {
+            pthread_mutex_unlock(&in->lock);
+            bool eof = !demux_fill_buffer(demux);
+            pthread_mutex_lock(&in->lock);
+            if (eof)
+                break;
+        }
     }
     MP_VERBOSE(demux, "ds_get_packets: EOF reached (stream: %s)\n",
                stream_type_name(sh->type));
@@ -422,24 +724,42 @@ static void ds_get_packets(struct sh_stream *sh)
 struct demux_packet *demux_read_packet(struct sh_stream *sh)
 {
     struct demux_stream *ds = sh ? sh->ds : NULL;
+    struct demux_packet *pkt = NULL;
     if (ds) {
+        struct demux_internal *in = sh->demuxer->in;
+        pthread_mutex_lock(&in->lock);
         ds_get_packets(sh);
-        struct demux_packet *pkt = ds->head;
+        pkt = ds->reader;
         if (pkt) {
-            ds->head = pkt->next;
-            pkt->next = NULL;
-            if (!ds->head)
-                ds->tail = NULL;
+            ds->reader = pkt->next;
             ds->bytes -= pkt->len;
             ds->packs--;
+            if (packet_time(pkt) != MP_NOPTS_VALUE)
+                ds->last_read_pts = packet_time(pkt);
+            if (sh->demuxer->opts->demuxer_back_buffer > 0) {
+                // keep the packet, and return a new reference to it
+                ds->back_packs++;
+                ds->back_bytes += pkt->len;
+                pkt = demux_ref_packet(pkt);
+                ds_prune_back_buffer(sh->demuxer, ds);
+            } else {
+                ds_prune_back_buffer(sh->demuxer, ds); // if disabled at runtime
+                assert(pkt == ds->head);
+                ds->head = pkt->next;
+                pkt->next = NULL;
+                if (!ds->head)
+                    ds->tail = NULL;
+            }
 
             if (pkt->stream_pts != MP_NOPTS_VALUE)
                 sh->demuxer->stream_pts = pkt->stream_pts;
 
-            return pkt;
+            // wake up the thread to read ahead more
+            pthread_cond_broadcast(&in->wakeup);
         }
+        pthread_mutex_unlock(&in->lock);
     }
-    return NULL;
+    return pkt;
 }
 
 // Return the pts of the next packet that demux_read_packet() would return.
@@ -447,18 +767,31 @@ struct demux_packet *demux_read_packet(struct sh_stream *sh)
 // packets from the queue.
 double demux_get_next_pts(struct sh_stream *sh)
 {
-    if (sh && sh->ds->selected) {
-        ds_get_packets(sh);
-        if (sh->ds->head)
-            return sh->ds->head->pts;
+    double res = MP_NOPTS_VALUE;
+    if (sh) {
+        struct demux_internal *in = sh->demuxer->in;
+        pthread_mutex_lock(&in->lock);
+        if (sh->ds->selected) {
+            ds_get_packets(sh);
+            if (sh->ds->reader)
+                res = sh->ds->reader->pts;
+        }
+        pthread_mutex_unlock(&in->lock);
     }
-    return MP_NOPTS_VALUE;
+    return res;
 }
 
 // Return whether a packet is queued. Never blocks, never forces any reads.
 bool demux_has_packet(struct sh_stream *sh)
 {
-    return sh && sh->ds->head;
+    bool res = false;
+    if (sh) {
+        struct demux_internal *in = sh->demuxer->in;
+        pthread_mutex_lock(&in->lock);
+        res = sh->ds->reader;
+        pthread_mutex_unlock(&in->lock);
+    }
+    return res;
 }
 
 // Same as demux_has_packet, but to be called internally by demuxers, as
@@ -471,7 +804,84 @@ bool demuxer_stream_has_packets_queued(struct demuxer *d, struct sh_stream *stre
 // Return whether EOF was returned with an earlier packet read.
 bool demux_stream_eof(struct sh_stream *sh)
 {
-    return !sh || sh->ds->eof;
+    if (!sh)
+        return true;
+    struct demux_internal *in = sh->demuxer->in;
+    pthread_mutex_lock(&in->lock);
+    bool eof = sh->ds->eof;
+    pthread_mutex_unlock(&in->lock);
+    return eof;
+}
+
+// Start a thread that reads packets ahead in the background. Streams that are
+// controlled by the player directly (DVD/BD menus, TV tuners) are not
+// supported, because the player accesses them without going through demux.c.
+void demux_start_thread(struct demuxer *demuxer)
+{
+    struct demux_internal *in = demuxer->in;
+    struct stream *s = demuxer->stream;
+    if (in->threading)
+        return;
+    if (stream_manages_timeline(s) || demuxer->type == DEMUXER_TYPE_TV ||
+        s->uncached_type == STREAMTYPE_PVR || s->uncached_type == STREAMTYPE_DVB)
+    {
+        MP_VERBOSE(demuxer, "Not using a demuxer thread with this stream.\n");
+        return;
+    }
+    in->thread_terminate = false;
+    in->thread_paused = false;
+    in->threading = true;
+    if (pthread_create(&in->thread, NULL, demux_thread, demuxer)) {
+        MP_ERR(demuxer, "Could not start demuxer thread.\n");
+        in->threading = false;
+        return;
+    }
+    MP_VERBOSE(demuxer, "Started demuxer thread.\n");
+}
+
+void demux_stop_thread(struct demuxer *demuxer)
+{
+    struct demux_internal *in = demuxer->in;
+    if (!in->threading)
+        return;
+    pthread_mutex_lock(&in->lock);
+    in->thread_terminate = true;
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
+    pthread_join(in->thread, NULL);
+    in->threading = false;
+    in->pause_count = 0;
+}
+
+// Stop the demuxer thread from accessing the demuxer, so that the caller can
+// call into the demuxer implementation. Waits until the current packet read
+// is finished. Calls can be nested; every call must be followed by
+// demux_unpause(). Does nothing without a demuxer thread (or demuxer).
+void demux_pause(struct demuxer *demuxer)
+{
+    if (!demuxer || !demuxer->in->threading ||
+        pthread_equal(pthread_self(), demuxer->in->thread))
+        return;
+    struct demux_internal *in = demuxer->in;
+    pthread_mutex_lock(&in->lock);
+    in->pause_count++;
+    pthread_cond_broadcast(&in->wakeup);
+    while (!in->thread_paused)
+        pthread_cond_wait(&in->wakeup, &in->lock);
+    pthread_mutex_unlock(&in->lock);
+}
+
+void demux_unpause(struct demuxer *demuxer)
+{
+    if (!demuxer || !demuxer->in->threading ||
+        pthread_equal(pthread_self(), demuxer->in->thread))
+        return;
+    struct demux_internal *in = demuxer->in;
+    pthread_mutex_lock(&in->lock);
+    assert(in->pause_count > 0);
+    in->pause_count--;
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
 }
 
 // ====================================================================
@@ -522,14 +932,21 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .glog = log,
         .filename = talloc_strdup(demuxer, stream->url),
         .metadata = talloc_zero(demuxer, struct mp_tags),
+        .in = talloc_zero(demuxer, struct demux_internal),
     };
+    pthread_mutex_init(&demuxer->in->lock, NULL);
+    pthread_cond_init(&demuxer->in->wakeup, NULL);
     demuxer->params = params; // temporary during open()
     stream_seek(stream, stream->start_pos);
 
     mp_verbose(log, "Trying demuxer: %s (force-level: %s)\n",
                desc->name, d_level(check));
 
+    int64_t start = mp_time_us();
     int ret = demuxer->desc->open(demuxer, check);
+    mp_verbose(log, "Demuxer %s %s after %.1f ms\n", desc->name,
+               ret >= 0 ? "opened" : "failed",
+               (mp_time_us() - start) / 1000.0);
     if (ret >= 0) {
         demuxer->params = NULL;
         if (demuxer->filetype)
@@ -573,6 +990,7 @@ struct demuxer *demux_open(struct stream *stream, char *force_format,
     const struct demuxer_desc *check_desc = NULL;
     struct mp_log *log = mp_log_new(NULL, global->log, "!demux");
     struct demuxer *demuxer = NULL;
+    void *probe_buf = NULL;
 
     if (!force_format)
         force_format = stream->demuxer;
@@ -594,47 +1012,76 @@ struct demuxer *demux_open(struct stream *stream, char *force_format,
     }
 
     // Peek this much data to avoid that stream_read() run by some demuxers
-    // or stream filters will flush previous peeked data.
-    stream_peek(stream, STREAM_BUFFER_SIZE);
+    // or stream filters will flush previous peeked data. This is also the
+    // data all probe functions look at. It's copied, because failed open
+    // attempts overwrite the stream buffer, and later passes probe again.
+    bstr probe_data = bstrdup(NULL, stream_peek(stream, STREAM_BUFFER_SIZE));
+    probe_buf = probe_data.start;
+    struct demux_probe probe = {
+        .data = probe_data,
+        .ext = stream->url ? mp_splitext(stream->url, NULL) : NULL,
+        .stream = stream,
+        .params = params,
+    };
 
     // Test demuxers from first to last, one pass for each check_levels[] entry
     for (int pass = 0; check_levels[pass] != -1; pass++) {
         enum demux_check level = check_levels[pass];
+
+        // Select the candidates first, so that demuxers which certainly can't
+        // open the file don't need to seek and read the stream again.
+        const struct demuxer_desc *candidates[MP_ARRAY_SIZE(demuxer_list)];
+        int num_candidates = 0;
+        char *names = talloc_strdup(NULL, "");
+        int64_t start = mp_time_us();
         for (int n = 0; demuxer_list[n]; n++) {
             const struct demuxer_desc *desc = demuxer_list[n];
-            if (!check_desc || desc == check_desc) {
-                demuxer = open_given_type(global, log, desc, stream, params, level);
-                if (demuxer) {
-                    talloc_steal(demuxer, log);
-                    log = NULL;
-                    goto done;
-                }
+            if (check_desc && desc != check_desc)
+                continue;
+            if (desc->probe && !desc->probe(&probe, level))
+                continue;
+            candidates[num_candidates++] = desc;
+            names = talloc_asprintf_append(names, " %s", desc->name);
+        }
+        mp_verbose(log, "Probing (%s, %d bytes) took %.3f ms, candidates:%s\n",
+                   d_level(level), (int)probe.data.len,
+                   (mp_time_us() - start) / 1000.0,
+                   num_candidates ? names : " none");
+        talloc_free(names);
+
+        for (int n = 0; n < num_candidates; n++) {
+            const struct demuxer_desc *desc = candidates[n];
+            demuxer = open_given_type(global, log, desc, stream, params, level);
+            if (demuxer) {
+                talloc_steal(demuxer, log);
+                log = NULL;
+                goto done;
             }
         }
     }
 
 done:
+    talloc_free(probe_buf);
     talloc_free(log);
     return demuxer;
 }
 
 void demux_flush(demuxer_t *demuxer)
 {
+    struct demux_internal *in = demuxer->in;
+    demux_pause(demuxer);
+    pthread_mutex_lock(&in->lock);
     for (int n = 0; n < demuxer->num_streams; n++)
         ds_free_packs(demuxer->streams[n]->ds);
     demuxer->warned_queue_overflow = false;
+    in->eof = false;
+    pthread_mutex_unlock(&in->lock);
+    demux_unpause(demuxer);
 }
 
-int demux_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
+static int demux_seek_paused(demuxer_t *demuxer, float rel_seek_secs,
+                             int flags)
 {
-    if (!demuxer->seekable) {
-        MP_WARN(demuxer, "Cannot seek in this file.\n");
-        return 0;
-    }
-
-    if (rel_seek_secs == MP_NOPTS_VALUE && (flags & SEEK_ABSOLUTE))
-        return 0;
-
     // clear demux buffers:
     demux_flush(demuxer);
 
@@ -677,6 +1124,141 @@ int demux_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
     return 1;
 }
 
+// Make dp the next packet returned by demux_read_packet(). dp must be in the
+// packet list (or NULL for the end of it).
+static void ds_set_reader(struct demuxer *demuxer, struct demux_stream *ds,
+                          struct demux_packet *dp)
+{
+    ds->reader = dp;
+    ds->packs = ds->bytes = 0;
+    ds->back_packs = ds->back_bytes = 0;
+    bool back = true;
+    for (struct demux_packet *cur = ds->head; cur; cur = cur->next) {
+        back &= cur != dp;
+        if (back) {
+            ds->back_packs++;
+            ds->back_bytes += cur->len;
+        } else {
+            ds->packs++;
+            ds->bytes += cur->len;
+        }
+    }
+    ds->eof = 0;
+    ds_prune_back_buffer(demuxer, ds);
+}
+
+// Try to serve the seek from the packets in memory (--demuxer-back-buffer).
+// The main stream (video, or audio if there's no video) is positioned on a
+// keyframe, the other streams on the last packet before that keyframe.
+// Called with the lock held.
+static bool demux_seek_in_buffer(demuxer_t *demuxer, float rel_seek_secs,
+                                 int flags)
+{
+    if (demuxer->opts->demuxer_back_buffer <= 0 || (flags & SEEK_FACTOR) ||
+        stream_manages_timeline(demuxer->stream))
+        return false;
+
+    struct sh_stream *main = NULL;
+    for (int n = 0; n < demuxer->num_streams; n++) {
+        struct sh_stream *sh = demuxer->streams[n];
+        if (!sh->ds->selected)
+            continue;
+        if (sh->type == STREAM_VIDEO && !sh->attached_picture) {
+            main = sh;
+            break;
+        }
+        if (sh->type == STREAM_AUDIO && !main)
+            main = sh;
+    }
+    if (!main || !main->ds->tail)
+        return false;
+
+    double target = rel_seek_secs;
+    if (!(flags & SEEK_ABSOLUTE)) {
+        if (main->ds->last_read_pts == MP_NOPTS_VALUE)
+            return false;
+        target += main->ds->last_read_pts;
+    }
+
+    struct demux_packet *kf = NULL;
+    for (struct demux_packet *dp = main->ds->head; dp; dp = dp->next) {
+        double t = packet_time(dp);
+        if (!dp->keyframe || t == MP_NOPTS_VALUE)
+            continue;
+        if (flags & SEEK_FORWARD) {
+            if (t >= target) {
+                kf = dp;
+                break;
+            }
+        } else {
+            if (t > target)
+                break;
+            kf = dp;
+        }
+    }
+    // A backward seek past the end of the queue could end up on a keyframe
+    // that wasn't read yet.
+    double end = packet_time(main->ds->tail);
+    if (!kf || end == MP_NOPTS_VALUE || end < target)
+        return false;
+    double kf_time = packet_time(kf);
+
+    struct demux_packet *start[MAX_SH_STREAMS + 1] = {0};
+    for (int n = 0; n < demuxer->num_streams; n++) {
+        struct sh_stream *sh = demuxer->streams[n];
+        if (!sh->ds->selected || sh == main)
+            continue;
+        for (struct demux_packet *dp = sh->ds->head; dp; dp = dp->next) {
+            double t = packet_time(dp);
+            if (t == MP_NOPTS_VALUE)
+                continue;
+            if (t > kf_time)
+                break;
+            start[n] = dp;
+        }
+        if (!start[n]) {
+            // Subtitles are sparse; anything else must be fully buffered.
+            if (sh->type != STREAM_SUB)
+                return false;
+            start[n] = sh->ds->head;
+        }
+    }
+
+    MP_VERBOSE(demuxer, "Seeking to %f within the demuxer back buffer.\n",
+               kf_time);
+    main->ds->last_read_pts = kf_time;
+    for (int n = 0; n < demuxer->num_streams; n++) {
+        struct sh_stream *sh = demuxer->streams[n];
+        if (sh->ds->selected)
+            ds_set_reader(demuxer, sh->ds, sh == main ? kf : start[n]);
+    }
+    return true;
+}
+
+int demux_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
+{
+    if (rel_seek_secs == MP_NOPTS_VALUE && (flags & SEEK_ABSOLUTE))
+        return 0;
+
+    struct demux_internal *in = demuxer->in;
+    pthread_mutex_lock(&in->lock);
+    bool buffered = demux_seek_in_buffer(demuxer, rel_seek_secs, flags);
+    pthread_cond_broadcast(&in->wakeup);
+    pthread_mutex_unlock(&in->lock);
+    if (buffered)
+        return 1;
+
+    if (!demuxer->seekable) {
+        MP_WARN(demuxer, "Cannot seek in this file.\n");
+        return 0;
+    }
+
+    demux_pause(demuxer);
+    int r = demux_seek_paused(demuxer, rel_seek_secs, flags);
+    demux_unpause(demuxer);
+    return r;
+}
+
 void mp_tags_set_str(struct mp_tags *tags, const char *key, const char *value)
 {
     mp_tags_set_bstr(tags, bstr0(key), bstr0(value));
@@ -760,6 +1342,7 @@ char *demux_info_get(demuxer_t *demuxer, const char *opt)
 
 void demux_info_update(struct demuxer *demuxer)
 {
+    demux_pause(demuxer);
     demux_control(demuxer, DEMUXER_CTRL_UPDATE_INFO, NULL);
     // Take care of stream metadata as well
     char **meta;
@@ -768,15 +1351,43 @@ void demux_info_update(struct demuxer *demuxer)
             demux_info_add(demuxer, meta[n + 0], meta[n + 1]);
         talloc_free(meta);
     }
+    demux_unpause(demuxer);
 }
 
 int demux_control(demuxer_t *demuxer, int cmd, void *arg)
 {
+    int r = DEMUXER_CTRL_NOTIMPL;
+    if (demuxer->desc->control) {
+        demux_pause(demuxer);
+        r = demuxer->desc->control(demuxer, cmd, arg);
+        demux_unpause(demuxer);
+    }
+    return r;
+}
 
-    if (demuxer->desc->control)
-        return demuxer->desc->control(demuxer, cmd, arg);
+// Like stream_control(demuxer->stream, ...), but safe with a demuxer thread.
+int demux_stream_control(demuxer_t *demuxer, int cmd, void *arg)
+{
+    demux_pause(demuxer);
+    int r = stream_control(demuxer->stream, cmd, arg);
+    demux_unpause(demuxer);
+    return r;
+}
 
-    return DEMUXER_CTRL_NOTIMPL;
+// Return the file position of the last demuxed packet, or the stream position
+// if unknown. Safe with a demuxer thread.
+int64_t demux_get_filepos(demuxer_t *demuxer)
+{
+    struct demux_internal *in = demuxer->in;
+    pthread_mutex_lock(&in->lock);
+    int64_t pos = demuxer->filepos;
+    pthread_mutex_unlock(&in->lock);
+    if (pos < 0) {
+        demux_pause(demuxer);
+        pos = stream_tell(demuxer->stream);
+        demux_unpause(demuxer);
+    }
+    return pos;
 }
 
 struct sh_stream *demuxer_stream_by_demuxer_id(struct demuxer *d,
@@ -807,9 +1418,15 @@ void demuxer_select_track(struct demuxer *demuxer, struct sh_stream *stream,
 {
     // don't flush buffers if stream is already selected / unselected
     if (stream->ds->selected != selected) {
+        struct demux_internal *in = demuxer->in;
+        demux_pause(demuxer);
+        pthread_mutex_lock(&in->lock);
         stream->ds->selected = selected;
         ds_free_packs(stream->ds);
+        in->eof = false;
+        pthread_mutex_unlock(&in->lock);
         demux_control(demuxer, DEMUXER_CTRL_SWITCHED_TRACKS, NULL);
+        demux_unpause(demuxer);
     }
 }
 
@@ -820,7 +1437,12 @@ void demuxer_enable_autoselect(struct demuxer *demuxer)
 
 bool demuxer_stream_is_selected(struct demuxer *d, struct sh_stream *stream)
 {
-    return stream && stream->ds->selected;
+    if (!stream)
+        return false;
+    pthread_mutex_lock(&d->in->lock);
+    bool selected = stream->ds->selected;
+    pthread_mutex_unlock(&d->in->lock);
+    return selected;
 }
 
 int demuxer_add_attachment(demuxer_t *demuxer, struct bstr name,
@@ -895,7 +1517,7 @@ static void add_stream_chapters(struct demuxer *demuxer)
     int num_chapters = demuxer_chapter_count(demuxer);
     for (int n = 0; n < num_chapters; n++) {
         double p = n;
-        if (stream_control(demuxer->stream, STREAM_CTRL_GET_CHAPTER_TIME, &p)
+        if (demux_stream_control(demuxer, STREAM_CTRL_GET_CHAPTER_TIME, &p)
                 != STREAM_OK)
             return;
         demuxer_add_chapter(demuxer, bstr0(""), p * 1e9, 0, 0);
@@ -916,7 +1538,7 @@ int demuxer_seek_chapter(demuxer_t *demuxer, int chapter, double *seek_pts)
     int ris = STREAM_UNSUPPORTED;
 
     if (demuxer->num_chapters == 0)
-        ris = stream_control(demuxer->stream, STREAM_CTRL_SEEK_TO_CHAPTER,
+        ris = demux_stream_control(demuxer, STREAM_CTRL_SEEK_TO_CHAPTER,
                              &chapter);
 
     if (ris != STREAM_UNSUPPORTED) {
@@ -944,7 +1566,7 @@ int demuxer_get_current_chapter(demuxer_t *demuxer, double time_now)
 {
     int chapter = -2;
     if (!demuxer->num_chapters || !demuxer->chapters) {
-        if (stream_control(demuxer->stream, STREAM_CTRL_GET_CURRENT_CHAPTER,
+        if (demux_stream_control(demuxer, STREAM_CTRL_GET_CURRENT_CHAPTER,
                            &chapter) == STREAM_UNSUPPORTED)
             chapter = -2;
     } else {
@@ -980,7 +1602,7 @@ int demuxer_chapter_count(demuxer_t *demuxer)
 {
     if (!demuxer->num_chapters || !demuxer->chapters) {
         int num_chapters = 0;
-        if (stream_control(demuxer->stream, STREAM_CTRL_GET_NUM_CHAPTERS,
+        if (demux_stream_control(demuxer, STREAM_CTRL_GET_NUM_CHAPTERS,
                            &num_chapters) == STREAM_UNSUPPORTED)
             num_chapters = 0;
         return num_chapters;
@@ -991,7 +1613,7 @@ int demuxer_chapter_count(demuxer_t *demuxer)
 double demuxer_get_time_length(struct demuxer *demuxer)
 {
     double len;
-    if (stream_control(demuxer->stream, STREAM_CTRL_GET_TIME_LENGTH, &len) > 0)
+    if (demux_stream_control(demuxer, STREAM_CTRL_GET_TIME_LENGTH, &len) > 0)
         return len;
     // <= 0 means DEMUXER_CTRL_NOTIMPL or DEMUXER_CTRL_DONTKNOW
     if (demux_control(demuxer, DEMUXER_CTRL_GET_TIME_LENGTH, &len) > 0)
@@ -1002,7 +1624,7 @@ double demuxer_get_time_length(struct demuxer *demuxer)
 double demuxer_get_start_time(struct demuxer *demuxer)
 {
     double time;
-    if (stream_control(demuxer->stream, STREAM_CTRL_GET_START_TIME, &time) > 0)
+    if (demux_stream_control(demuxer, STREAM_CTRL_GET_START_TIME, &time) > 0)
         return time;
     if (demux_control(demuxer, DEMUXER_CTRL_GET_START_TIME, &time) > 0)
         return time;
@@ -1013,7 +1635,7 @@ int demuxer_angles_count(demuxer_t *demuxer)
 {
     int ris, angles = -1;
 
-    ris = stream_control(demuxer->stream, STREAM_CTRL_GET_NUM_ANGLES, &angles);
+    ris = demux_stream_control(demuxer, STREAM_CTRL_GET_NUM_ANGLES, &angles);
     if (ris == STREAM_UNSUPPORTED)
         return -1;
     return angles;
@@ -1022,7 +1644,7 @@ int demuxer_angles_count(demuxer_t *demuxer)
 int demuxer_get_current_angle(demuxer_t *demuxer)
 {
     int ris, curr_angle = -1;
-    ris = stream_control(demuxer->stream, STREAM_CTRL_GET_ANGLE, &curr_angle);
+    ris = demux_stream_control(demuxer, STREAM_CTRL_GET_ANGLE, &curr_angle);
     if (ris == STREAM_UNSUPPORTED)
         return -1;
     return curr_angle;
@@ -1039,7 +1661,7 @@ int demuxer_set_angle(demuxer_t *demuxer, int angle)
 
     demux_flush(demuxer);
 
-    ris = stream_control(demuxer->stream, STREAM_CTRL_SET_ANGLE, &angle);
+    ris = demux_stream_control(demuxer, STREAM_CTRL_SET_ANGLE, &angle);
     if (ris == STREAM_UNSUPPORTED)
         return -1;
 
@@ -1108,8 +1730,7 @@ struct demux_packet *demux_packet_list_fill(struct demux_packet **pkts,
         *current = 0;
     if (*current >= num_pkts)
         return NULL;
-    struct demux_packet *new = talloc(NULL, struct demux_packet);
-    *new = *pkts[*current];
+    struct demux_packet *new = demux_copy_packet(pkts[*current]);
     *current += 1;
     return new;
 }
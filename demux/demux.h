@@ -56,6 +56,7 @@ enum demux_ctrl {
     DEMUXER_CTRL_GET_START_TIME,
     DEMUXER_CTRL_RESYNC,
     DEMUXER_CTRL_IDENTIFY_PROGRAM,
+    DEMUXER_CTRL_LOAD_ATTACHMENTS,  // read demuxer->attachments if deferred
 };
 
 #define SEEK_ABSOLUTE (1 << 0)
@@ -86,6 +87,15 @@ enum demux_check {
 #define MAX_SH_STREAMS 256
 
 struct demuxer;
+struct demuxer_params;
+
+// Passed to demuxer_desc.probe. Shared by all demuxers tried by demux_open().
+struct demux_probe {
+    struct bstr data;       // start of the stream (peeked, no seeking needed)
+    const char *ext;        // file extension of the URL (without '.'), or NULL
+    struct stream *stream;  // only for checking the stream type; don't read
+    struct demuxer_params *params;
+};
 
 /**
  * Demuxer description structure
@@ -99,6 +109,10 @@ typedef struct demuxer_desc {
     // Return 0 on success, otherwise -1
     int (*open)(struct demuxer *demuxer, enum demux_check check);
     // The following functions are all optional
+    // Cheap check whether open() could succeed, using only the data in p.
+    // Return false to skip open() for this check level. open() is never
+    // called if this returns false.
+    bool (*probe)(struct demux_probe *p, enum demux_check check);
     int (*fill_buffer)(struct demuxer *demuxer); // 0 on EOF, otherwise 1
     void (*close)(struct demuxer *demuxer);
     void (*seek)(struct demuxer *demuxer, float rel_seek_secs, int flags);
@@ -198,6 +212,7 @@ typedef struct demuxer {
     struct mpv_global *global;
     struct mp_log *log, *glog;
     struct demuxer_params *params;
+    struct demux_internal *in; // internal to demux.c
 } demuxer_t;
 
 typedef struct {
@@ -209,9 +224,15 @@ struct demux_packet *new_demux_packet(size_t len);
 // data must already have suitable padding
 struct demux_packet *new_demux_packet_fromdata(void *data, size_t len);
 struct demux_packet *new_demux_packet_from(void *data, size_t len);
+struct demux_packet *new_demux_packet_ref(struct demux_packet *src,
+                                          void *data, size_t len);
+struct AVBufferRef;
+struct demux_packet *new_demux_packet_from_avbuf(struct AVBufferRef *buf,
+                                                 void *data, size_t len);
 void resize_demux_packet(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
 struct demux_packet *demux_copy_packet(struct demux_packet *dp);
+struct demux_packet *demux_ref_packet(struct demux_packet *dp);
 
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t)-1)
@@ -244,6 +265,14 @@ int demux_info_print(struct demuxer *demuxer);
 void demux_info_update(struct demuxer *demuxer);
 
 int demux_control(struct demuxer *demuxer, int cmd, void *arg);
+int demux_stream_control(struct demuxer *demuxer, int cmd, void *arg);
+int64_t demux_get_filepos(struct demuxer *demuxer);
+
+void demux_start_thread(struct demuxer *demuxer);
+void demux_stop_thread(struct demuxer *demuxer);
+double demux_get_buffered_secs(struct demuxer *demuxer);
+void demux_pause(struct demuxer *demuxer);
+void demux_unpause(struct demuxer *demuxer);
 
 void demuxer_switch_track(struct demuxer *demuxer, enum stream_type type,
                           struct sh_stream *stream);
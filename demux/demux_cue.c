@@ -31,18 +31,17 @@ bool mp_probe_cue(struct bstr s);
 
 #define PROBE_SIZE 512
 
+static bool probe_file(struct demux_probe *p, enum demux_check check)
+{
+    if (check < DEMUX_CHECK_UNSAFE)
+        return true;
+    bstr buf = bstr_splice(p->data, 0, PROBE_SIZE);
+    return buf.len > 0 && mp_probe_cue(buf);
+}
+
 static int try_open_file(struct demuxer *demuxer, enum demux_check check)
 {
     struct stream *s = demuxer->stream;
-    if (check >= DEMUX_CHECK_UNSAFE) {
-        char buf[PROBE_SIZE];
-        int len = stream_read(s, buf, sizeof(buf));
-        if (len <= 0)
-            return -1;
-        if (!mp_probe_cue((struct bstr) { buf, len }))
-            return -1;
-        stream_seek(s, 0);
-    }
     demuxer->file_contents = stream_read_complete(s, demuxer, 1000000);
     if (demuxer->file_contents.start == NULL)
         return -1;
@@ -53,5 +52,6 @@ const struct demuxer_desc demuxer_desc_cue = {
     .name = "cue",
     .desc = "CUE sheet",
     .type = DEMUXER_TYPE_CUE,
+    .probe = probe_file,
     .open = try_open_file,
 };
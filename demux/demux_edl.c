@@ -27,6 +27,12 @@
 
 #define HEADER "# mpv EDL v0\n"
 
+static bool probe_file(struct demux_probe *p, enum demux_check check)
+{
+    return p->stream->uncached_type == STREAMTYPE_EDL ||
+           check < DEMUX_CHECK_UNSAFE || bstr_startswith0(p->data, HEADER);
+}
+
 // Note: the real work is handled in tl_mpv_edl.c.
 static int try_open_file(struct demuxer *demuxer, enum demux_check check)
 {
@@ -35,10 +41,6 @@ static int try_open_file(struct demuxer *demuxer, enum demux_check check)
         demuxer->file_contents = bstr0(s->path);
         return 0;
     }
-    if (check >= DEMUX_CHECK_UNSAFE) {
-        if (!bstr_equals0(stream_peek(s, strlen(HEADER)), HEADER))
-            return -1;
-    }
     demuxer->file_contents = stream_read_complete(s, demuxer, 1000000);
     if (demuxer->file_contents.start == NULL)
         return -1;
@@ -50,5 +52,6 @@ const struct demuxer_desc demuxer_desc_edl = {
     .name = "edl",
     .desc = "Edit decision list",
     .type = DEMUXER_TYPE_EDL,
+    .probe = probe_file,
     .open = try_open_file,
 };
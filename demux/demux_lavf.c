@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
@@ -67,6 +68,7 @@ const m_option_t lavfdopts_conf[] = {
     OPT_CHOICE("genpts-mode", lavfdopts.genptsmode, 0,
                ({"lavf", 1}, {"no", 0})),
     OPT_STRING("o", lavfdopts.avopt, 0),
+    OPT_FLAG("probe-cache", lavfdopts.probe_cache, 0),
     {NULL, NULL, 0, 0, 0, 0, NULL}
 };
 
@@ -83,6 +85,8 @@ typedef struct lavf_priv {
     int num_streams;
     int cur_program;
     char *mime_type;
+    struct probe_cache_key *cache_key; // set if the probe cache was used
+    int validate_packets;
 } lavf_priv_t;
 
 struct format_hack {
@@ -512,6 +516,212 @@ static void add_metadata(demuxer_t *demuxer, AVDictionary *metadata)
         demux_info_add(demuxer, t->key, t->value);
 }
 
+// The probe cache remembers what avformat_find_stream_info() found out about a
+// file, so that it can be skipped when the same file is opened again (which
+// is slow, because it reads and decodes packets). Only used for formats that
+// declare all streams in the header.
+
+#define PROBE_CACHE_ENTRIES 32
+// Amount of data at the start of the file that identifies it.
+#define PROBE_CACHE_HASH_SIZE 4096
+// Number of packets checked for streams unknown to the cached result.
+#define PROBE_CACHE_VALIDATE_PACKETS 50
+
+struct probe_cache_key {
+    char *filename;
+    int64_t size;
+    uint64_t hash;
+};
+
+struct probe_cache_stream {
+    enum AVMediaType codec_type;
+    enum AVCodecID codec_id;
+    bool has_extradata;
+    int bit_rate;
+    int width, height;
+    enum AVPixelFormat pix_fmt;
+    AVRational sample_aspect_ratio;
+    AVRational avg_frame_rate;
+    int sample_rate, channels;
+    uint64_t channel_layout;
+    enum AVSampleFormat sample_fmt;
+};
+
+struct probe_cache_entry {
+    struct probe_cache_key key;
+    char *format;
+    int64_t duration, start_time;
+    struct probe_cache_stream *streams;
+    int num_streams;
+};
+
+static pthread_mutex_t probe_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct probe_cache_entry *probe_cache[PROBE_CACHE_ENTRIES]; // MRU first
+
+static struct probe_cache_key *get_probe_cache_key(struct demuxer *demuxer)
+{
+    struct stream *s = demuxer->stream;
+    lavf_priv_t *priv = demuxer->priv;
+    if (s->end_pos <= 0 || (priv->avif->flags & AVFMT_NOFILE) ||
+        s->type == STREAMTYPE_AVDEVICE)
+        return NULL;
+    bstr head = stream_peek(s, PROBE_CACHE_HASH_SIZE);
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (int n = 0; n < head.len; n++)
+        hash = (hash ^ head.start[n]) * 0x100000001b3ULL;
+    struct probe_cache_key *key = talloc_ptrtype(priv, key);
+    *key = (struct probe_cache_key) {
+        .filename = talloc_strdup(key, priv->filename),
+        .size = s->end_pos,
+        .hash = hash,
+    };
+    return key;
+}
+
+static bool probe_cache_key_equals(struct probe_cache_key *a,
+                                   struct probe_cache_key *b)
+{
+    return a->size == b->size && a->hash == b->hash &&
+           strcmp(a->filename, b->filename) == 0;
+}
+
+// Must be called with probe_cache_lock held.
+static int probe_cache_find(struct probe_cache_key *key)
+{
+    for (int n = 0; n < PROBE_CACHE_ENTRIES && probe_cache[n]; n++) {
+        if (probe_cache_key_equals(&probe_cache[n]->key, key))
+            return n;
+    }
+    return -1;
+}
+
+// Must be called with probe_cache_lock held.
+static void probe_cache_remove(int index)
+{
+    talloc_free(probe_cache[index]);
+    for (int n = index; n < PROBE_CACHE_ENTRIES - 1; n++)
+        probe_cache[n] = probe_cache[n + 1];
+    probe_cache[PROBE_CACHE_ENTRIES - 1] = NULL;
+}
+
+static void probe_cache_store(struct demuxer *demuxer)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    AVFormatContext *avfc = priv->avfc;
+
+    struct probe_cache_entry *e = talloc_zero(NULL, struct probe_cache_entry);
+    e->key = *priv->cache_key;
+    e->key.filename = talloc_strdup(e, e->key.filename);
+    e->format = talloc_strdup(e, priv->avif->name);
+    e->duration = avfc->duration;
+    e->start_time = avfc->start_time;
+    e->num_streams = avfc->nb_streams;
+    e->streams = talloc_array(e, struct probe_cache_stream, e->num_streams);
+    for (int n = 0; n < e->num_streams; n++) {
+        AVStream *st = avfc->streams[n];
+        AVCodecContext *c = st->codec;
+        e->streams[n] = (struct probe_cache_stream) {
+            .codec_type = c->codec_type,
+            .codec_id = c->codec_id,
+            .has_extradata = c->extradata_size > 0,
+            .bit_rate = c->bit_rate,
+            .width = c->width,
+            .height = c->height,
+            .pix_fmt = c->pix_fmt,
+            .sample_aspect_ratio = st->sample_aspect_ratio,
+            .avg_frame_rate = st->avg_frame_rate,
+            .sample_rate = c->sample_rate,
+            .channels = c->channels,
+            .channel_layout = c->channel_layout,
+            .sample_fmt = c->sample_fmt,
+        };
+    }
+
+    pthread_mutex_lock(&probe_cache_lock);
+    int index = probe_cache_find(&e->key);
+    if (index < 0)
+        index = PROBE_CACHE_ENTRIES - 1;
+    probe_cache_remove(index);
+    memmove(&probe_cache[1], &probe_cache[0],
+            (PROBE_CACHE_ENTRIES - 1) * sizeof(probe_cache[0]));
+    probe_cache[0] = e;
+    pthread_mutex_unlock(&probe_cache_lock);
+}
+
+static void probe_cache_invalidate(struct probe_cache_key *key)
+{
+    pthread_mutex_lock(&probe_cache_lock);
+    int index = probe_cache_find(key);
+    if (index >= 0)
+        probe_cache_remove(index);
+    pthread_mutex_unlock(&probe_cache_lock);
+}
+
+#define SET_IF_UNSET(field, unset, value) \
+    do { if ((field) == (unset)) (field) = (value); } while (0)
+
+// Fill in the stream parameters from the cache, if the streams opened by
+// avformat_open_input() match the cached entry. Return false if the full
+// avformat_find_stream_info() pass is needed.
+static bool probe_cache_apply(struct demuxer *demuxer)
+{
+    lavf_priv_t *priv = demuxer->priv;
+    AVFormatContext *avfc = priv->avfc;
+    bool ok = false;
+
+    if (avfc->ctx_flags & AVFMTCTX_NOHEADER)
+        return false;
+
+    pthread_mutex_lock(&probe_cache_lock);
+    int index = probe_cache_find(priv->cache_key);
+    if (index < 0)
+        goto done;
+    struct probe_cache_entry *e = probe_cache[index];
+    if (strcmp(e->format, priv->avif->name) != 0 ||
+        e->num_streams != avfc->nb_streams)
+        goto mismatch;
+    for (int n = 0; n < e->num_streams; n++) {
+        struct probe_cache_stream *cs = &e->streams[n];
+        AVCodecContext *c = avfc->streams[n]->codec;
+        if (cs->codec_type != c->codec_type || cs->codec_id != c->codec_id ||
+            (cs->has_extradata && !c->extradata_size))
+            goto mismatch;
+    }
+
+    for (int n = 0; n < e->num_streams; n++) {
+        struct probe_cache_stream *cs = &e->streams[n];
+        AVStream *st = avfc->streams[n];
+        AVCodecContext *c = st->codec;
+        SET_IF_UNSET(c->bit_rate, 0, cs->bit_rate);
+        SET_IF_UNSET(c->width, 0, cs->width);
+        SET_IF_UNSET(c->height, 0, cs->height);
+        SET_IF_UNSET(c->pix_fmt, AV_PIX_FMT_NONE, cs->pix_fmt);
+        SET_IF_UNSET(st->sample_aspect_ratio.num, 0, cs->sample_aspect_ratio.num);
+        SET_IF_UNSET(st->sample_aspect_ratio.den, 0, cs->sample_aspect_ratio.den);
+        SET_IF_UNSET(st->avg_frame_rate.num, 0, cs->avg_frame_rate.num);
+        SET_IF_UNSET(st->avg_frame_rate.den, 0, cs->avg_frame_rate.den);
+        SET_IF_UNSET(c->sample_rate, 0, cs->sample_rate);
+        SET_IF_UNSET(c->channels, 0, cs->channels);
+        SET_IF_UNSET(c->channel_layout, 0, cs->channel_layout);
+        SET_IF_UNSET(c->sample_fmt, AV_SAMPLE_FMT_NONE, cs->sample_fmt);
+    }
+    SET_IF_UNSET(avfc->duration, AV_NOPTS_VALUE, e->duration);
+    SET_IF_UNSET(avfc->start_time, AV_NOPTS_VALUE, e->start_time);
+
+    // Move to front.
+    memmove(&probe_cache[1], &probe_cache[0], index * sizeof(probe_cache[0]));
+    probe_cache[0] = e;
+    ok = true;
+    goto done;
+
+mismatch:
+    MP_VERBOSE(demuxer, "Cached probe result doesn't match, discarding it.\n");
+    probe_cache_remove(index);
+done:
+    pthread_mutex_unlock(&probe_cache_lock);
+    return ok;
+}
+
 static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
 {
     struct MPOpts *opts = demuxer->opts;
@@ -595,6 +805,9 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
             av_dict_set(&dopts, "rtsp_transport", transport, 0);
     }
 
+    if (lavfdopts->probe_cache)
+        priv->cache_key = get_probe_cache_key(demuxer);
+
     if (avformat_open_input(&avfc, priv->filename, priv->avif, &dopts) < 0) {
         MP_ERR(demuxer, "LAVF_header: avformat_open_input() failed\n");
         av_dict_free(&dopts);
@@ -609,13 +822,21 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
     av_dict_free(&dopts);
 
     priv->avfc = avfc;
-    if (avformat_find_stream_info(avfc, NULL) < 0) {
-        MP_ERR(demuxer, "LAVF_header: av_find_stream_info() failed\n");
-        return -1;
-    }
+    if (priv->cache_key && probe_cache_apply(demuxer)) {
+        MP_VERBOSE(demuxer, "Using cached stream info.\n");
+        priv->validate_packets = PROBE_CACHE_VALIDATE_PACKETS;
+    } else {
+        if (avformat_find_stream_info(avfc, NULL) < 0) {
+            MP_ERR(demuxer, "LAVF_header: av_find_stream_info() failed\n");
+            return -1;
+        }
 
-    MP_VERBOSE(demuxer, "demux_lavf: avformat_find_stream_info() "
-           "finished after %"PRId64" bytes.\n", stream_tell(demuxer->stream));
+        MP_VERBOSE(demuxer, "demux_lavf: avformat_find_stream_info() "
+               "finished after %"PRId64" bytes.\n", stream_tell(demuxer->stream));
+
+        if (priv->cache_key && !(avfc->ctx_flags & AVFMTCTX_NOHEADER))
+            probe_cache_store(demuxer);
+    }
 
     for (i = 0; i < avfc->nb_chapters; i++) {
         AVChapter *c = avfc->chapters[i];
@@ -682,6 +903,18 @@ static int demux_lavf_fill_buffer(demuxer_t *demux)
     }
     talloc_set_destructor(pkt, destroy_avpacket);
 
+    if (priv->validate_packets > 0) {
+        priv->validate_packets--;
+        // A stream showing up late means the header didn't describe the file
+        // completely, and the cached result might be incomplete too.
+        if (priv->avfc->nb_streams != priv->num_streams) {
+            MP_WARN(demux, "Unexpected stream; not using cached stream info "
+                    "for this file again.\n");
+            probe_cache_invalidate(priv->cache_key);
+            priv->validate_packets = 0;
+        }
+    }
+
     add_new_streams(demux);
 
     assert(pkt->stream_index >= 0 && pkt->stream_index < priv->num_streams);
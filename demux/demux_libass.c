@@ -33,6 +33,11 @@ struct priv {
     ASS_Track *track;
 };
 
+static bool d_probe_file(struct demux_probe *p, enum demux_check check)
+{
+    return p->params && p->params->ass_library;
+}
+
 static int d_check_file(struct demuxer *demuxer, enum demux_check check)
 {
     const char *user_cp = demuxer->opts->sub_cp;
@@ -118,6 +123,7 @@ static void d_close(struct demuxer *demuxer)
 const struct demuxer_desc demuxer_desc_libass = {
     .name = "libass",
     .desc = "ASS/SSA subtitles (libass)",
+    .probe = d_probe_file,
     .open = d_check_file,
     .close = d_close,
 };
@@ -22,8 +22,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "osdep/io.h"
+#include "osdep/numcores.h"
 
 #include "talloc.h"
 #include "config.h"
@@ -36,6 +38,160 @@
 
 #define MF_MAX_FILE_SIZE (1024 * 1024 * 256)
 
+#define MF_MAX_PREFETCH_THREADS 8
+
+// Image files are read by worker threads, up to a few frames ahead of the
+// current frame, so that demux_mf_fill_buffer() doesn't need to wait for the
+// file system. Frame n is loaded into slots[n % num_slots].
+enum slot_state {
+    SLOT_EMPTY,
+    SLOT_QUEUED,    // waiting for a worker
+    SLOT_LOADING,   // a worker is reading the file
+    SLOT_DONE,      // pkt set (NULL if reading failed)
+};
+
+struct mf_slot {
+    int frame;
+    enum slot_state state;
+    struct demux_packet *pkt;
+};
+
+struct mf_prefetch {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool terminate;
+    char **names;
+    int nr_of_files;
+    struct mf_slot *slots;
+    int num_slots;
+    pthread_t threads[MF_MAX_PREFETCH_THREADS];
+    int num_threads;
+};
+
+static struct demux_packet *read_file_packet(const char *filename)
+{
+    struct demux_packet *dp = NULL;
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
+    if (fseeko(f, 0, SEEK_END) == 0) {
+        off_t size = ftello(f);
+        if (size > 0 && size <= MF_MAX_FILE_SIZE && fseeko(f, 0, SEEK_SET) == 0) {
+            dp = new_demux_packet(size);
+            if (fread(dp->buffer, size, 1, f) != 1) {
+                talloc_free(dp);
+                dp = NULL;
+            }
+        }
+    }
+    fclose(f);
+    return dp;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    struct mf_prefetch *p = arg;
+    pthread_mutex_lock(&p->lock);
+    while (!p->terminate) {
+        // Load the earliest queued frame first.
+        struct mf_slot *slot = NULL;
+        for (int n = 0; n < p->num_slots; n++) {
+            struct mf_slot *s = &p->slots[n];
+            if (s->state == SLOT_QUEUED && (!slot || s->frame < slot->frame))
+                slot = s;
+        }
+        if (!slot) {
+            pthread_cond_wait(&p->wakeup, &p->lock);
+            continue;
+        }
+        int frame = slot->frame;
+        slot->state = SLOT_LOADING;
+        pthread_mutex_unlock(&p->lock);
+        struct demux_packet *dp = read_file_packet(p->names[frame]);
+        pthread_mutex_lock(&p->lock);
+        // The slot might have been reassigned by a seek meanwhile.
+        if (slot->frame == frame && slot->state == SLOT_LOADING) {
+            slot->pkt = dp;
+            slot->state = SLOT_DONE;
+            pthread_cond_broadcast(&p->wakeup);
+        } else {
+            talloc_free(dp);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void prefetch_destroy(struct mf_prefetch *p)
+{
+    if (!p)
+        return;
+    pthread_mutex_lock(&p->lock);
+    p->terminate = true;
+    pthread_cond_broadcast(&p->wakeup);
+    pthread_mutex_unlock(&p->lock);
+    for (int n = 0; n < p->num_threads; n++)
+        pthread_join(p->threads[n], NULL);
+    for (int n = 0; n < p->num_slots; n++)
+        talloc_free(p->slots[n].pkt);
+    pthread_cond_destroy(&p->wakeup);
+    pthread_mutex_destroy(&p->lock);
+    talloc_free(p);
+}
+
+static struct mf_prefetch *prefetch_create(struct demuxer *demuxer, mf_t *mf)
+{
+    int threads = default_thread_count();
+    threads = MPCLAMP(threads, 1, MF_MAX_PREFETCH_THREADS);
+
+    struct mf_prefetch *p = talloc_zero(NULL, struct mf_prefetch);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wakeup, NULL);
+    p->names = mf->names;
+    p->nr_of_files = mf->nr_of_files;
+    p->num_slots = threads * 2;
+    p->slots = talloc_zero_array(p, struct mf_slot, p->num_slots);
+    for (int n = 0; n < p->num_slots; n++)
+        p->slots[n].frame = -1;
+    for (int n = 0; n < threads; n++) {
+        if (pthread_create(&p->threads[n], NULL, prefetch_thread, p))
+            break;
+        p->num_threads++;
+    }
+    if (!p->num_threads) {
+        prefetch_destroy(p);
+        return NULL;
+    }
+    MP_VERBOSE(demuxer, "Prefetching %d files with %d threads.\n",
+               p->num_slots, p->num_threads);
+    return p;
+}
+
+// Return the packet for the given frame, or NULL if the file couldn't be read
+// by the prefetch threads. Queues the following frames for reading.
+static struct demux_packet *prefetch_get(struct mf_prefetch *p, int frame)
+{
+    pthread_mutex_lock(&p->lock);
+    for (int n = 0; n < p->num_slots; n++) {
+        int f = frame + n;
+        if (f >= p->nr_of_files)
+            break;
+        struct mf_slot *s = &p->slots[f % p->num_slots];
+        if (s->frame != f) {
+            talloc_free(s->pkt);
+            *s = (struct mf_slot){ .frame = f, .state = SLOT_QUEUED };
+        }
+    }
+    pthread_cond_broadcast(&p->wakeup);
+    struct mf_slot *s = &p->slots[frame % p->num_slots];
+    while (s->state != SLOT_DONE)
+        pthread_cond_wait(&p->wakeup, &p->lock);
+    struct demux_packet *dp = s->pkt;
+    *s = (struct mf_slot){ .frame = -1 };
+    pthread_mutex_unlock(&p->lock);
+    return dp;
+}
+
 static void demux_seek_mf(demuxer_t *demuxer, float rel_seek_secs, int flags)
 {
     mf_t *mf = demuxer->priv;
@@ -61,6 +217,18 @@ static int demux_mf_fill_buffer(demuxer_t *demuxer)
     if (mf->curr_frame >= mf->nr_of_files)
         return 0;
 
+    if (mf->prefetch) {
+        demux_packet_t *dp = prefetch_get(mf->prefetch, mf->curr_frame);
+        if (dp) {
+            dp->pts = mf->curr_frame / mf->sh->fps;
+            dp->keyframe = true;
+            demuxer_add_packet(demuxer, demuxer->streams[0], dp);
+            mf->curr_frame++;
+            return 1;
+        }
+        // Not a plain file? Try again with a stream.
+    }
+
     struct stream *entry_stream = NULL;
     if (mf->streams)
         entry_stream = mf->streams[mf->curr_frame];
@@ -166,6 +334,11 @@ static const char *probe_format(mf_t *mf, enum demux_check check)
     return NULL;
 }
 
+static bool demux_probe_mf(struct demux_probe *p, enum demux_check check)
+{
+    return check <= DEMUX_CHECK_REQUEST;
+}
+
 static int demux_open_mf(demuxer_t *demuxer, enum demux_check check)
 {
     sh_video_t *sh_video = NULL;
@@ -202,6 +375,9 @@ static int demux_open_mf(demuxer_t *demuxer, enum demux_check check)
     demuxer->priv = (void *)mf;
     demuxer->seekable = true;
 
+    if (!mf->streams && mf->nr_of_files > 1)
+        mf->prefetch = prefetch_create(demuxer, mf);
+
     return 0;
 
 error:
@@ -210,6 +386,9 @@ error:
 
 static void demux_close_mf(demuxer_t *demuxer)
 {
+    mf_t *mf = demuxer->priv;
+    if (mf)
+        prefetch_destroy(mf->prefetch);
 }
 
 static int demux_control_mf(demuxer_t *demuxer, int cmd, void *arg)
@@ -230,6 +409,7 @@ const demuxer_desc_t demuxer_desc_mf = {
     .name = "mf",
     .desc = "image files (mf)",
     .fill_buffer = demux_mf_fill_buffer,
+    .probe = demux_probe_mf,
     .open = demux_open_mf,
     .close = demux_close_mf,
     .seek = demux_seek_mf,
@@ -45,6 +45,8 @@
 #include "talloc.h"
 #include "common/av_common.h"
 #include "options/options.h"
+#include "options/path.h"
+#include "osdep/io.h"
 #include "bstr/bstr.h"
 #include "stream/stream.h"
 #include "demux.h"
@@ -178,10 +180,23 @@ typedef struct mkv_demuxer {
     uint64_t cluster_start;
     uint64_t cluster_end;
 
+    // If cluster_buf.len > 0, the current cluster is parsed from this buffer
+    // instead of the stream (see load_cluster()). It points either into
+    // cluster_view (the whole cluster, borrowed from the stream), or into
+    // cluster_window (a part of the cluster). The stream is positioned at
+    // cluster_buf_end.
+    struct stream_view cluster_view;
+    unsigned char *cluster_window;
+    size_t cluster_window_size;
+    bstr cluster_buf;
+    int64_t cluster_buf_end;
+
     mkv_index_t *indexes;
     int num_indexes;
+    int num_cached_indexes; // number of entries loaded from the index cache
     bool index_complete;
     uint64_t deferred_cues;
+    int64_t deferred_attachments;
 
     int64_t *parsed_pos;
     int num_parsed_pos;
@@ -716,6 +731,108 @@ static void add_block_position(demuxer_t *demuxer, struct mkv_track *track,
     track->last_index_entry = mkv_d->num_indexes - 1;
 }
 
+#define INDEX_CACHE_SUBDIR "mkv-index"
+
+// Return the filename of the --demuxer-mkv-index-cache entry for this segment,
+// or NULL if not available.
+static char *get_index_cache_file(void *talloc_ctx, demuxer_t *demuxer)
+{
+    if (!demuxer->opts->mkv_index_cache)
+        return NULL;
+    int64_t size = demuxer->stream->end_pos;
+    unsigned char *uid = demuxer->matroska_data.uid.segment;
+    char name[sizeof(demuxer->matroska_data.uid.segment) * 2 + 1];
+    bool has_uid = false;
+    for (int n = 0; n < sizeof(demuxer->matroska_data.uid.segment); n++) {
+        has_uid |= uid[n];
+        snprintf(name + n * 2, 3, "%02X", uid[n]);
+    }
+    if (!has_uid || size <= 0)
+        return NULL;
+    mp_mk_config_dir(demuxer->global, INDEX_CACHE_SUBDIR);
+    char *dir = mp_find_user_config_file(talloc_ctx, demuxer->global,
+                                         INDEX_CACHE_SUBDIR);
+    if (!dir || !mp_path_isdir(dir))
+        return NULL;
+    return talloc_asprintf(talloc_ctx, "%s/%s-%"PRId64".idx", dir, name, size);
+}
+
+// Load an index written by save_index_cache(). The index created by
+// create_index_until() always covers the file from the start, so
+// indexing can continue after the last loaded entry.
+static void load_index_cache(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    void *tmp = talloc_new(NULL);
+    char *filename = get_index_cache_file(tmp, demuxer);
+    FILE *f = filename ? fopen(filename, "r") : NULL;
+    if (!f)
+        goto done;
+    char line[256];
+    uint64_t tc_scale = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int tnum;
+        uint64_t timecode, filepos;
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "tc_scale %"SCNu64, &tc_scale) == 1) {
+            if (tc_scale != mkv_d->tc_scale)
+                break;
+            continue;
+        }
+        if (!tc_scale || sscanf(line, "%d %"SCNu64" %"SCNu64, &tnum,
+                                &timecode, &filepos) != 3)
+            break;
+        struct mkv_track *track = NULL;
+        for (int n = 0; n < mkv_d->num_tracks; n++) {
+            if (mkv_d->tracks[n]->tnum == tnum)
+                track = mkv_d->tracks[n];
+        }
+        if (!track || filepos >= demuxer->stream->end_pos)
+            break;
+        add_block_position(demuxer, track, filepos, timecode);
+    }
+    fclose(f);
+    mkv_d->num_cached_indexes = mkv_d->num_indexes;
+    MP_VERBOSE(demuxer, "Loaded %d index entries from %s\n",
+               mkv_d->num_indexes, filename);
+done:
+    talloc_free(tmp);
+}
+
+static void save_index_cache(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    if (mkv_d->index_complete || mkv_d->num_indexes <= mkv_d->num_cached_indexes)
+        return;
+    void *tmp = talloc_new(NULL);
+    char *filename = get_index_cache_file(tmp, demuxer);
+    if (!filename)
+        goto done;
+    char *tmpname = talloc_asprintf(tmp, "%s.tmp", filename);
+    FILE *f = fopen(tmpname, "w");
+    if (!f)
+        goto done;
+    fprintf(f, "# mpv Matroska index cache\n");
+    fprintf(f, "tc_scale %"PRIu64"\n", mkv_d->tc_scale);
+    for (int n = 0; n < mkv_d->num_indexes; n++) {
+        mkv_index_t *index = &mkv_d->indexes[n];
+        fprintf(f, "%d %"PRIu64" %"PRIu64"\n", index->tnum, index->timecode,
+                index->filepos);
+    }
+    bool ok = !ferror(f);
+    ok &= fclose(f) == 0;
+    if (ok && rename(tmpname, filename) == 0) {
+        MP_VERBOSE(demuxer, "Saved %d index entries to %s\n",
+                   mkv_d->num_indexes, filename);
+    } else {
+        MP_WARN(demuxer, "Could not write index cache %s\n", filename);
+        unlink(tmpname);
+    }
+done:
+    talloc_free(tmp);
+}
+
 static int demux_mkv_read_cues(demuxer_t *demuxer)
 {
     struct MPOpts *opts = demuxer->opts;
@@ -1116,10 +1233,11 @@ static int read_header_element(struct demuxer *demuxer, uint32_t id,
     case MATROSKA_ID_ATTACHMENTS:
         if (mkv_d->parsed_attachments)
             break;
-        if (at_filepos && !seek_pos_id(demuxer, at_filepos, id))
-            return -1;
+        // Attachments can be big (fonts), and are read only when requested
+        // with DEMUXER_CTRL_LOAD_ATTACHMENTS.
         mkv_d->parsed_attachments = true;
-        return demux_mkv_read_attachments(demuxer);
+        mkv_d->deferred_attachments = at_filepos ? at_filepos : pos;
+        break;
 
     case EBML_ID_VOID:
         break;
@@ -1783,6 +1901,12 @@ static int read_mkv_segment_header(demuxer_t *demuxer)
     return 0;
 }
 
+static bool demux_mkv_probe(struct demux_probe *p, enum demux_check check)
+{
+    bstr buf = p->data;
+    return ebml_read_id_buf(&buf) == EBML_ID_EBML;
+}
+
 static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
 {
     stream_t *s = demuxer->stream;
@@ -1826,6 +1950,9 @@ static int demux_mkv_open(demuxer_t *demuxer, enum demux_check check)
 
     display_create_tracks(demuxer);
 
+    if (!mkv_d->index_complete && !mkv_d->deferred_cues)
+        load_index_cache(demuxer);
+
     return 0;
 }
 
@@ -2250,17 +2377,29 @@ struct block_info {
     uint64_t timecode;
     mkv_track_t *track;
     bstr data;
+    struct stream_view view;
     void *alloc;
     int64_t filepos;
 };
 
 static void free_block(struct block_info *block)
 {
+    stream_release_view(&block->view);
     free(block->alloc);
     block->alloc = NULL;
     block->data = (bstr){0};
 }
 
+// lzo decompression may read up to AV_LZO_INPUT_PADDING bytes past the input.
+static bool track_needs_input_padding(mkv_track_t *track)
+{
+    for (int i = 0; i < track->num_encodings; i++) {
+        if (track->encodings[i].comp_algo == 2)
+            return true;
+    }
+    return false;
+}
+
 static void index_block(demuxer_t *demuxer, struct block_info *block)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
@@ -2270,27 +2409,14 @@ static void index_block(demuxer_t *demuxer, struct block_info *block)
     }
 }
 
-static int read_block(demuxer_t *demuxer, struct block_info *block)
+// Parse the header of the Block element in block->data.
+static int parse_block(demuxer_t *demuxer, struct block_info *block)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
-    stream_t *s = demuxer->stream;
     uint64_t num;
     int16_t time;
-    uint64_t length;
     int res = -1;
 
-    free_block(block);
-    length = ebml_read_length(s, NULL);
-    if (length > 500000000)
-        goto exit;
-    block->alloc = malloc(length + AV_LZO_INPUT_PADDING);
-    if (!block->alloc)
-        goto exit;
-    block->data = (bstr){block->alloc, length};
-    block->filepos = stream_tell(s);
-    if (stream_read(s, block->data.start, block->data.len) != block->data.len)
-        goto exit;
-
     // Parse header of the Block element
     /* first byte(s): track num */
     num = ebml_read_vlen_uint(&block->data);
@@ -2316,6 +2442,15 @@ static int read_block(demuxer_t *demuxer, struct block_info *block)
         goto exit;
     }
 
+    if (track_needs_input_padding(block->track)) {
+        block->alloc = malloc(block->data.len + AV_LZO_INPUT_PADDING);
+        if (!block->alloc)
+            goto exit;
+        memcpy(block->alloc, block->data.start, block->data.len);
+        block->data.start = block->alloc;
+        stream_release_view(&block->view);
+    }
+
     res = 1;
 exit:
     if (res <= 0)
@@ -2323,6 +2458,48 @@ exit:
     return res;
 }
 
+static int read_block(demuxer_t *demuxer, struct block_info *block)
+{
+    stream_t *s = demuxer->stream;
+
+    free_block(block);
+    uint64_t length = ebml_read_length(s, NULL);
+    if (length > 500000000)
+        return -1;
+    block->filepos = stream_tell(s);
+    // Avoid copying the block data: the payload is copied directly from the
+    // stream (or cache) memory into the demux packets.
+    stream_read_view(s, length, &block->view);
+    if (block->view.len != length) {
+        free_block(block);
+        return -1;
+    }
+    block->data = (bstr){block->view.data, length};
+    return parse_block(demuxer, block);
+}
+
+// File position of the start of buf, which must point into cluster_buf.
+static int64_t cluster_buf_pos(mkv_demuxer_t *mkv_d, bstr buf)
+{
+    return mkv_d->cluster_buf_end - buf.len;
+}
+
+// Like read_block(), but the block data points into the cluster buffer.
+static int read_block_buf(demuxer_t *demuxer, bstr *buf,
+                          struct block_info *block)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+
+    free_block(block);
+    uint64_t length = ebml_read_vlen_uint(buf);
+    if (length == EBML_UINT_INVALID || length > buf->len)
+        return -1;
+    block->filepos = cluster_buf_pos(mkv_d, *buf);
+    block->data = (bstr){buf->start, length};
+    *buf = bstr_cut(*buf, length);
+    return parse_block(demuxer, block);
+}
+
 static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
@@ -2381,6 +2558,12 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
         mkv_d->last_pts = current_pts;
         mkv_d->last_filepos = block_info->filepos;
 
+        // With lacing, copy the data of all laces once, and let the packets
+        // reference it. This is done on first use only, because decoding
+        // (content encodings) or parsing can create new data anyway.
+        struct demux_packet *laced = NULL;
+        bstr block_data = data;
+
         int p = 0;
         for (int i = 0; i < laces; i++) {
             bstr block = bstr_splice(data, 0, lace_size[i]);
@@ -2392,8 +2575,20 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
                 bstr raw = demux_mkv_decode(demuxer->log, track, block, 1);
                 bstr buffer;
                 while (raw.start && mkv_parse_packet(track, &raw, &buffer)) {
-                    demux_packet_t *dp =
-                        new_demux_packet_from(buffer.start, buffer.len);
+                    demux_packet_t *dp;
+                    if (laces > 1 && buffer.start >= block_data.start &&
+                        buffer.start + buffer.len <=
+                            block_data.start + block_data.len)
+                    {
+                        if (!laced)
+                            laced = new_demux_packet_from(block_data.start,
+                                                          block_data.len);
+                        size_t offset = buffer.start - block_data.start;
+                        dp = new_demux_packet_ref(laced, laced->buffer + offset,
+                                                  buffer.len);
+                    } else {
+                        dp = new_demux_packet_from(buffer.start, buffer.len);
+                    }
                     dp->keyframe = keyframe;
                     /* If default_duration is 0, assume no pts value is known
                      * for packets after the first one (rather than all pts
@@ -2410,6 +2605,7 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
             }
             data = bstr_cut(data, lace_size[i]);
         }
+        talloc_free(laced);
 
         if (stream->type == STREAM_VIDEO) {
             mkv_d->v_skip_to_keyframe = 0;
@@ -2471,12 +2667,247 @@ error:
     return -1;
 }
 
+// Clusters up to this size are parsed directly from the stream's memory, if
+// the stream can lend it. No element can be larger than this either.
+#define MAX_CLUSTER_BUFFER (16 * 1024 * 1024)
+// Otherwise, the cluster is read in parts of (at least) this size.
+#define CLUSTER_WINDOW_SIZE (256 * 1024)
+
+// Stop parsing from the cluster buffer, and continue reading the current
+// cluster from the stream at the current buffer position.
+static void drop_cluster_buffer(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    int64_t pos = cluster_buf_pos(mkv_d, mkv_d->cluster_buf);
+    bool resume = mkv_d->cluster_buf.len > 0;
+    stream_release_view(&mkv_d->cluster_view);
+    mkv_d->cluster_buf = (bstr){0};
+    if (resume)
+        stream_seek(demuxer->stream, pos);
+}
+
+// Read the next part of the current cluster into cluster_window. keep is the
+// unparsed rest of the current buffer (or empty), and is moved to the start of
+// the window. At least min_size bytes are buffered, unless the cluster ends
+// before. On failure (or at the end of the cluster), the buffer is dropped,
+// the stream is positioned at the start of keep, and false is returned.
+static bool fill_cluster_window(demuxer_t *demuxer, bstr keep,
+                                uint64_t min_size)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    int64_t left = mkv_d->cluster_end - stream_tell(s);
+    if (left <= 0 || min_size > MAX_CLUSTER_BUFFER)
+        goto fail;
+    int64_t read = CLUSTER_WINDOW_SIZE;
+    if (min_size > keep.len)
+        read = MPMAX(read, (int64_t)(min_size - keep.len));
+    read = MPMIN(read, left);
+    size_t size = keep.len + read;
+    if (size > MAX_CLUSTER_BUFFER)
+        goto fail;
+
+    if (keep.len)
+        memmove(mkv_d->cluster_window, keep.start, keep.len);
+    if (mkv_d->cluster_window_size < size) {
+        mkv_d->cluster_window = talloc_realloc_size(mkv_d,
+                                        mkv_d->cluster_window, size);
+        mkv_d->cluster_window_size = size;
+    }
+    int64_t keep_pos = stream_tell(s) - keep.len;
+    if (stream_read(s, mkv_d->cluster_window + keep.len, read) != read) {
+        mkv_d->cluster_buf = (bstr){0};
+        stream_seek(s, keep_pos);
+        return false;
+    }
+    mkv_d->cluster_buf = (bstr){mkv_d->cluster_window, size};
+    mkv_d->cluster_buf_end = stream_tell(s);
+    return true;
+
+fail:
+    mkv_d->cluster_buf = keep;
+    drop_cluster_buffer(demuxer);
+    return false;
+}
+
+// Start parsing the current cluster from memory (the stream must be positioned
+// after the cluster header). If the stream can lend its memory for the whole
+// cluster, the data is not copied. Otherwise, it's read in parts into
+// cluster_window, which is still much cheaper than reading each element
+// header from the stream.
+static void load_cluster(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    stream_release_view(&mkv_d->cluster_view);
+    mkv_d->cluster_buf = (bstr){0};
+    // Falling back to stream reads on errors requires seeking back.
+    if (mkv_d->cluster_end == EBML_UINT_INVALID ||
+        !(s->flags & MP_STREAM_SEEK_BW))
+        return;
+    int64_t start = stream_tell(s);
+    int64_t size = mkv_d->cluster_end - start;
+    if (size <= 0)
+        return;
+    if (size <= MAX_CLUSTER_BUFFER &&
+        stream_borrow_view(s, size, &mkv_d->cluster_view))
+    {
+        mkv_d->cluster_buf = (bstr){mkv_d->cluster_view.data, size};
+        mkv_d->cluster_buf_end = stream_tell(s);
+        return;
+    }
+    if (stream_tell(s) != start)
+        stream_seek(s, start);
+    fill_cluster_window(demuxer, (bstr){0}, 0);
+}
+
+static int read_block_group_buf(demuxer_t *demuxer, bstr group,
+                                struct block_info *block)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    *block = (struct block_info){ .keyframe = true };
+
+    while (group.len) {
+        uint64_t len;
+        switch (ebml_read_id_buf(&group)) {
+        case MATROSKA_ID_BLOCKDURATION:
+            block->duration = ebml_read_uint_buf(&group);
+            if (block->duration == EBML_UINT_INVALID)
+                goto error;
+            block->duration *= mkv_d->tc_scale;
+            break;
+
+        case MATROSKA_ID_BLOCK:
+            if (read_block_buf(demuxer, &group, block) < 0)
+                goto error;
+            break;
+
+        case MATROSKA_ID_REFERENCEBLOCK:;
+            int64_t num = ebml_read_int_buf(&group);
+            if (num == EBML_INT_INVALID)
+                goto error;
+            if (num)
+                block->keyframe = false;
+            break;
+
+        case EBML_ID_INVALID:
+            goto error;
+
+        default:
+            len = ebml_read_vlen_uint(&group);
+            if (len == EBML_UINT_INVALID || len > group.len)
+                goto error;
+            group = bstr_cut(group, len);
+            break;
+        }
+    }
+
+    return block->data.start ? 1 : 0;
+
+error:
+    free_block(block);
+    return -1;
+}
+
+// Parse the next block from the cluster buffer. Returns 1 if a block was
+// found, 0 if the cluster ended, or if parsing has to continue with the stream
+// (on anything unusual, the buffer is dropped and the element is re-read
+// from the stream, which takes care of error handling and resyncing).
+static int read_next_block_buf(demuxer_t *demuxer, struct block_info *block)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    bstr *buf = &mkv_d->cluster_buf;
+    bstr element;
+    uint64_t need; // size of the current element, if known
+
+    for (;;) {
+        if (!buf->len && !fill_cluster_window(demuxer, (bstr){0}, 0))
+            return 0;
+        element = *buf;
+        need = 0;
+        uint64_t len;
+        switch (ebml_read_id_buf(buf)) {
+        case MATROSKA_ID_TIMECODE: {
+            uint64_t num = ebml_read_uint_buf(buf);
+            if (num == EBML_UINT_INVALID)
+                goto fallback;
+            mkv_d->cluster_tc = num * mkv_d->tc_scale;
+            break;
+        }
+
+        case MATROSKA_ID_BLOCKGROUP: {
+            len = ebml_read_vlen_uint(buf);
+            if (len == EBML_UINT_INVALID)
+                goto fallback;
+            need = buf->start - element.start + len;
+            if (len > buf->len)
+                goto fallback;
+            int res = read_block_group_buf(demuxer, bstr_splice(*buf, 0, len),
+                                           block);
+            if (res < 0)
+                goto fallback;
+            *buf = bstr_cut(*buf, len);
+            if (res > 0)
+                return 1;
+            break;
+        }
+
+        case MATROSKA_ID_SIMPLEBLOCK: {
+            bstr header = *buf;
+            len = ebml_read_vlen_uint(&header);
+            if (len != EBML_UINT_INVALID)
+                need = header.start - element.start + len;
+            *block = (struct block_info){ .simple = true };
+            int res = read_block_buf(demuxer, buf, block);
+            if (res < 0)
+                goto fallback;
+            if (res > 0)
+                return 1;
+            break;
+        }
+
+        case MATROSKA_ID_CLUSTER:
+        case EBML_ID_INVALID:
+            goto fallback;
+
+        default:
+            len = ebml_read_vlen_uint(buf);
+            if (len == EBML_UINT_INVALID)
+                goto fallback;
+            need = buf->start - element.start + len;
+            if (len > buf->len)
+                goto fallback;
+            *buf = bstr_cut(*buf, len);
+            break;
+        }
+        continue;
+
+    fallback:
+        // If the element might be cut off at the end of the window, retry with
+        // a new window starting with it (and large enough for it).
+        if (element.start != mkv_d->cluster_window || need > element.len) {
+            if (fill_cluster_window(demuxer, element, need))
+                continue;
+            return 0;
+        }
+        *buf = element;
+        drop_cluster_buffer(demuxer);
+        return 0;
+    }
+}
+
 static int read_next_block(demuxer_t *demuxer, struct block_info *block)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
     stream_t *s = demuxer->stream;
 
     while (1) {
+        if (mkv_d->cluster_buf.len) {
+            if (read_next_block_buf(demuxer, block) > 0)
+                return 1;
+        }
         while (stream_tell(s) < mkv_d->cluster_end) {
             int64_t start_filepos = stream_tell(s);
             switch (ebml_read_id(s, NULL)) {
@@ -2539,6 +2970,7 @@ static int read_next_block(demuxer_t *demuxer, struct block_info *block)
         // mkv files for "streaming" can have this legally
         if (mkv_d->cluster_end != EBML_UINT_INVALID)
             mkv_d->cluster_end += stream_tell(s);
+        load_cluster(demuxer);
     }
 }
 
@@ -2590,6 +3022,7 @@ static int create_index_until(struct demuxer *demuxer, uint64_t timecode)
     mkv_index_t *index = get_highest_index_entry(demuxer);
 
     if (!index || index->timecode * mkv_d->tc_scale < timecode) {
+        drop_cluster_buffer(demuxer);
         int64_t old_filepos = stream_tell(s);
         int64_t old_cluster_start = mkv_d->cluster_start;
         int64_t old_cluster_end = mkv_d->cluster_end;
@@ -2611,6 +3044,7 @@ static int create_index_until(struct demuxer *demuxer, uint64_t timecode)
             if (index && index->timecode * mkv_d->tc_scale >= timecode)
                 break;
         }
+        drop_cluster_buffer(demuxer);
         stream_seek(s, old_filepos);
         mkv_d->cluster_start = old_cluster_start;
         mkv_d->cluster_end = old_cluster_end;
@@ -2681,6 +3115,7 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
 static void demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
 {
     mkv_demuxer_t *mkv_d = demuxer->priv;
+    drop_cluster_buffer(demuxer);
     int64_t old_pos = stream_tell(demuxer->stream);
     uint64_t v_tnum = -1;
     uint64_t a_tnum = -1;
@@ -2779,11 +3214,32 @@ static void demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
     }
 }
 
+static void read_deferred_attachments(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    if (mkv_d->deferred_attachments) {
+        int64_t pos = mkv_d->deferred_attachments;
+        mkv_d->deferred_attachments = 0;
+        // The cluster buffer (if any) stays valid, as the stream is restored
+        // to the same position.
+        int64_t old_pos = stream_tell(s);
+        if (seek_pos_id(demuxer, pos, MATROSKA_ID_ATTACHMENTS))
+            demux_mkv_read_attachments(demuxer);
+        if (!stream_seek(s, old_pos))
+            MP_WARN(demuxer, "Failed to seek back after reading attachments\n");
+    }
+}
+
 static int demux_mkv_control(demuxer_t *demuxer, int cmd, void *arg)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
 
     switch (cmd) {
+    case DEMUXER_CTRL_LOAD_ATTACHMENTS:
+        read_deferred_attachments(demuxer);
+        return DEMUXER_CTRL_OK;
     case DEMUXER_CTRL_GET_TIME_LENGTH:
         if (mkv_d->duration == 0)
             return DEMUXER_CTRL_DONTKNOW;
@@ -2801,6 +3257,8 @@ static void mkv_free(struct demuxer *demuxer)
     if (!mkv_d)
         return;
     mkv_seek_reset(demuxer);
+    stream_release_view(&mkv_d->cluster_view);
+    save_index_cache(demuxer);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
     free(mkv_d->indexes);
@@ -2810,6 +3268,7 @@ const demuxer_desc_t demuxer_desc_matroska = {
     .name = "mkv",
     .desc = "Matroska",
     .type = DEMUXER_TYPE_MATROSKA,
+    .probe = demux_mkv_probe,
     .open = demux_mkv_open,
     .fill_buffer = demux_mkv_fill_buffer,
     .close = mkv_free,
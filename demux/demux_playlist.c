@@ -155,6 +155,26 @@ static const struct pl_format *probe_pl(struct pl_parser *p, bool force)
     return NULL;
 }
 
+// Quick check for the first line of the formats in formats[].
+static bool probe_file(struct demux_probe *p, enum demux_check check)
+{
+    if (check < DEMUX_CHECK_UNSAFE || check == DEMUX_CHECK_REQUEST)
+        return true;
+    bstr data = p->data;
+    if (bstr_startswith0(data, "\xFF\xFE") || bstr_startswith0(data, "\xFE\xFF"))
+        return true; // UTF-16, leave it to the real parser
+    bstr_eatstart0(&data, "\xEF\xBB\xBF");
+    data = bstr_lstrip(data);
+    static const char *const magic[] = {
+        "#EXTM3U", "[Reference]", "RTSPtext", "[playlist]",
+    };
+    for (int n = 0; n < MP_ARRAY_SIZE(magic); n++) {
+        if (bstr_case_startswith(data, bstr0(magic[n])))
+            return true;
+    }
+    return false;
+}
+
 static int open_file(struct demuxer *demuxer, enum demux_check check)
 {
     bool force = check < DEMUX_CHECK_UNSAFE || check == DEMUX_CHECK_REQUEST;
@@ -189,5 +209,6 @@ static int open_file(struct demuxer *demuxer, enum demux_check check)
 const struct demuxer_desc demuxer_desc_playlist = {
     .name = "playlist",
     .desc = "Playlist file",
+    .probe = probe_file,
     .open = open_file,
 };
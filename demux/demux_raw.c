@@ -22,7 +22,18 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_MMAN_H && HAVE_AVUTIL_REFCOUNTING
+#include <libavutil/buffer.h>
+#endif
+
+#include "compat/atomics.h"
 #include "options/m_option.h"
 
 #include "stream/stream.h"
@@ -33,20 +44,32 @@
 #include "video/img_format.h"
 #include "video/img_fourcc.h"
 
+// Whole file mapped into memory. Packets reference it directly, and keep it
+// alive after the demuxer is closed if needed.
+struct raw_map {
+    unsigned char *data;
+    size_t size;
+    int refcount;
+};
+
 struct priv {
     int frame_size;
     int read_frames;
     double frame_rate;
+    struct raw_map *map;    // if not NULL, read packets from here
+    int64_t map_pos;        // current file position if map is used
 };
 
 static struct mp_chmap channels = MP_CHMAP_INIT_STEREO;
 static int samplerate = 44100;
 static int aformat = AF_FORMAT_S16;
+static int audio_mmap = 1;
 
 const m_option_t demux_rawaudio_opts[] = {
     { "channels", &channels, &m_option_type_chmap, CONF_MIN, 1 },
     { "rate", &samplerate, CONF_TYPE_INT, CONF_RANGE, 1000, 8 * 48000, NULL },
     { "format", &aformat, CONF_TYPE_AFMT, 0, 0, 0, NULL },
+    { "mmap", &audio_mmap, CONF_TYPE_FLAG, 0, 0, 1, NULL },
     {NULL, NULL, 0, 0, 0, 0, NULL}
 };
 
@@ -57,6 +80,7 @@ static int width = 1280;
 static int height = 720;
 static float fps = 25;
 static int imgsize = 0;
+static int video_mmap = 1;
 
 const m_option_t demux_rawvideo_opts[] = {
     // size:
@@ -69,10 +93,69 @@ const m_option_t demux_rawvideo_opts[] = {
     // misc:
     { "fps", &fps, CONF_TYPE_FLOAT, CONF_RANGE, 0.001, 1000, NULL },
     { "size", &imgsize, CONF_TYPE_INT, CONF_RANGE, 1, 8192 * 8192 * 4, NULL },
+    { "mmap", &video_mmap, CONF_TYPE_FLAG, 0, 0, 1, NULL },
 
     {NULL, NULL, 0, 0, 0, 0, NULL}
 };
 
+// Raw data can't be detected; it must be selected explicitly.
+static bool raw_probe(struct demux_probe *p, enum demux_check check)
+{
+    return check == DEMUX_CHECK_REQUEST || check == DEMUX_CHECK_FORCE;
+}
+
+static void raw_map_unref(struct raw_map *m)
+{
+#if HAVE_SYS_MMAN_H
+    if (m && mp_atomic_add_and_fetch(&m->refcount, -1) == 0) {
+        munmap(m->data, m->size);
+        talloc_free(m);
+    }
+#endif
+}
+
+#if HAVE_SYS_MMAN_H && HAVE_AVUTIL_REFCOUNTING
+static void free_packet_buf(void *opaque, uint8_t *data)
+{
+    raw_map_unref(opaque);
+}
+#endif
+
+// Map the file if it's a plain local file.
+static void map_file(struct demuxer *demuxer)
+{
+#if HAVE_SYS_MMAN_H && HAVE_AVUTIL_REFCOUNTING
+    struct priv *p = demuxer->priv;
+    struct stream *s = demuxer->stream;
+    if (s->type != STREAMTYPE_FILE || s->uncached_stream || !s->path ||
+        strcmp(s->path, "-") == 0)
+        return;
+    int fd = open(s->path, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        st.st_size == s->end_pos && (uint64_t)st.st_size <= SIZE_MAX)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            p->map = talloc_ptrtype(NULL, p->map);
+            *p->map = (struct raw_map){data, st.st_size, 1};
+            p->map_pos = stream_tell(s);
+            MP_VERBOSE(demuxer, "Reading from memory mapped file.\n");
+        }
+    }
+    close(fd);
+#endif
+}
+
+static void raw_close(demuxer_t *demuxer)
+{
+    struct priv *p = demuxer->priv;
+    if (p)
+        raw_map_unref(p->map);
+}
+
 static int demux_rawaudio_open(demuxer_t *demuxer, enum demux_check check)
 {
     struct sh_stream *sh;
@@ -108,6 +191,9 @@ static int demux_rawaudio_open(demuxer_t *demuxer, enum demux_check check)
         .read_frames = samplerate,
     };
 
+    if (audio_mmap)
+        map_file(demuxer);
+
     return 0;
 }
 
@@ -189,24 +275,57 @@ static int demux_rawvideo_open(demuxer_t *demuxer, enum demux_check check)
         .read_frames = 1,
     };
 
+    if (video_mmap)
+        map_file(demuxer);
+
     return 0;
 }
 
 static int raw_fill_buffer(demuxer_t *demuxer)
 {
     struct priv *p = demuxer->priv;
+    int len = p->frame_size * p->read_frames;
+
+#if HAVE_SYS_MMAN_H && HAVE_AVUTIL_REFCOUNTING
+    if (p->map) {
+        struct raw_map *m = p->map;
+        if (p->map_pos >= m->size)
+            return 0;
+        // The padding after the packet must be readable.
+        if (p->map_pos + len + MP_INPUT_BUFFER_PADDING_SIZE <= m->size) {
+            unsigned char *data = m->data + p->map_pos;
+            mp_atomic_add_and_fetch(&m->refcount, 1);
+            AVBufferRef *buf = av_buffer_create(data, len, free_packet_buf, m,
+                                                AV_BUFFER_FLAG_READONLY);
+            if (!buf)
+                abort();
+            struct demux_packet *dp = new_demux_packet_from_avbuf(buf, data, len);
+            av_buffer_unref(&buf);
+            dp->pos = p->map_pos - demuxer->stream->start_pos;
+            dp->pts = (dp->pos / p->frame_size) / p->frame_rate;
+            p->map_pos += len;
+            demuxer_add_packet(demuxer, demuxer->streams[0], dp);
+            return 1;
+        }
+        // End of the file: read it normally.
+        stream_seek(demuxer->stream, p->map_pos);
+    }
+#endif
 
     if (demuxer->stream->eof)
         return 0;
 
-    struct demux_packet *dp = new_demux_packet(p->frame_size * p->read_frames);
+    struct demux_packet *dp = new_demux_packet(len);
     dp->pos = stream_tell(demuxer->stream) - demuxer->stream->start_pos;
     dp->pts = (dp->pos  / p->frame_size) / p->frame_rate;
 
-    int len = stream_read(demuxer->stream, dp->buffer, dp->len);
-    resize_demux_packet(dp, len);
+    int got = stream_read(demuxer->stream, dp->buffer, dp->len);
+    resize_demux_packet(dp, got);
     demuxer_add_packet(demuxer, demuxer->streams[0], dp);
 
+    if (p->map)
+        p->map_pos = got > 0 ? stream_tell(demuxer->stream) : p->map->size;
+
     return 1;
 }
 
@@ -217,7 +336,8 @@ static void raw_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
     stream_update_size(s);
     int64_t start = s->start_pos;
     int64_t end = s->end_pos;
-    int64_t pos = (flags & SEEK_ABSOLUTE) ? start : stream_tell(s);
+    int64_t cur = p->map ? p->map_pos : stream_tell(s);
+    int64_t pos = (flags & SEEK_ABSOLUTE) ? start : cur;
     if (flags & SEEK_FACTOR)
         pos += (end - start) * rel_seek_secs;
     else
@@ -226,7 +346,12 @@ static void raw_seek(demuxer_t *demuxer, float rel_seek_secs, int flags)
         pos = 0;
     if (end && pos > end)
         pos = end;
-    stream_seek(s, (pos / p->frame_size) * p->frame_size);
+    pos = (pos / p->frame_size) * p->frame_size;
+    if (p->map) {
+        p->map_pos = pos;
+    } else {
+        stream_seek(s, pos);
+    }
 }
 
 static int raw_control(demuxer_t *demuxer, int cmd, void *arg)
@@ -253,8 +378,10 @@ static int raw_control(demuxer_t *demuxer, int cmd, void *arg)
 const demuxer_desc_t demuxer_desc_rawaudio = {
     .name = "rawaudio",
     .desc = "Uncompressed audio",
+    .probe = raw_probe,
     .open = demux_rawaudio_open,
     .fill_buffer = raw_fill_buffer,
+    .close = raw_close,
     .seek = raw_seek,
     .control = raw_control,
 };
@@ -262,8 +389,10 @@ const demuxer_desc_t demuxer_desc_rawaudio = {
 const demuxer_desc_t demuxer_desc_rawvideo = {
     .name = "rawvideo",
     .desc = "Uncompressed video",
+    .probe = raw_probe,
     .open = demux_rawvideo_open,
     .fill_buffer = raw_fill_buffer,
+    .close = raw_close,
     .seek = raw_seek,
     .control = raw_control,
 };
@@ -1332,6 +1332,12 @@ static struct stream *read_probe_stream(struct stream *s, int max)
 
 #define PROBE_SIZE FFMIN(32 * 1024, STREAM_MAX_BUFFER_SIZE)
 
+static bool d_probe_file(struct demux_probe *p, enum demux_check check)
+{
+    return check <= DEMUX_CHECK_REQUEST && p->params &&
+           p->params->expect_subtitle;
+}
+
 static int d_open_file(struct demuxer *demuxer, enum demux_check check)
 {
     if (check > DEMUX_CHECK_REQUEST)
@@ -1401,6 +1407,7 @@ static int d_control(struct demuxer *demuxer, int cmd, void *arg)
 const struct demuxer_desc demuxer_desc_subreader = {
     .name = "subreader",
     .desc = "Deprecated MPlayer subreader",
+    .probe = d_probe_file,
     .open = d_open_file,
     .fill_buffer = d_fill_buffer,
     .seek = d_seek,
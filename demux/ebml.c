@@ -27,6 +27,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <string.h>
 #include <assert.h>
 
 #include <libavutil/intfloat.h>
@@ -447,6 +448,48 @@ static double ebml_parse_float(uint8_t *data, int length)
         return av_int2double(i);
 }
 
+/*
+ * Buffer versions of ebml_read_id(), ebml_read_uint() and ebml_read_int().
+ * On success, the element is removed from the start of the buffer. On
+ * failure, the buffer is left in an undefined state.
+ */
+uint32_t ebml_read_id_buf(bstr *buffer)
+{
+    uint8_t data[4] = {0};
+    if (buffer->len < 1)
+        return EBML_ID_INVALID;
+    memcpy(data, buffer->start, FFMIN(buffer->len, 4));
+    int len;
+    uint32_t id = ebml_parse_id(data, &len);
+    if (len < 0 || len > buffer->len)
+        return EBML_ID_INVALID;
+    buffer->start += len;
+    buffer->len -= len;
+    return id;
+}
+
+uint64_t ebml_read_uint_buf(bstr *buffer)
+{
+    uint64_t len = ebml_read_vlen_uint(buffer);
+    if (len == EBML_UINT_INVALID || len < 1 || len > 8 || len > buffer->len)
+        return EBML_UINT_INVALID;
+    uint64_t value = ebml_parse_uint(buffer->start, len);
+    buffer->start += len;
+    buffer->len -= len;
+    return value;
+}
+
+int64_t ebml_read_int_buf(bstr *buffer)
+{
+    uint64_t len = ebml_read_vlen_uint(buffer);
+    if (len == EBML_UINT_INVALID || len < 1 || len > 8 || len > buffer->len)
+        return EBML_INT_INVALID;
+    int64_t value = ebml_parse_sint(buffer->start, len);
+    buffer->start += len;
+    buffer->len -= len;
+    return value;
+}
+
 
 // target must be initialized to zero
 static void ebml_parse_element(struct ebml_parse_ctx *ctx, void *target,
@@ -107,6 +107,10 @@ int ebml_read_skip_or_resync_cluster(struct mp_log *log, stream_t *s,
 int ebml_resync_cluster(struct mp_log *log, stream_t *s);
 uint32_t ebml_read_master (stream_t *s, uint64_t *length);
 
+uint32_t ebml_read_id_buf(bstr *buffer);
+uint64_t ebml_read_uint_buf(bstr *buffer);
+int64_t ebml_read_int_buf(bstr *buffer);
+
 int ebml_read_element(struct stream *s, struct ebml_parse_ctx *ctx,
                       void *target, const struct ebml_elem_desc *desc);
 
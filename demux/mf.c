@@ -24,7 +24,9 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include "osdep/io.h"
 
@@ -52,6 +54,81 @@ static void mf_add(mf_t *mf, const char *fname)
     MP_TARRAY_APPEND(mf, mf->names, mf->nr_of_files, entry);
 }
 
+// Cache of the file lists found for glob and printf patterns. Scanning large
+// directories is slow, and the same pattern is often opened repeatedly (e.g.
+// when looping a playlist). An entry is valid as long as the modification
+// time of the directory doesn't change.
+#define MF_CACHE_ENTRIES 8
+
+struct mf_cache_entry {
+    char *pattern;
+    struct stat dir_st;
+    char **names;
+    int nr_of_files;
+};
+
+static pthread_mutex_t mf_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mf_cache_entry *mf_cache[MF_CACHE_ENTRIES]; // MRU first
+
+static bool mf_cache_stat(const char *pattern, struct stat *st)
+{
+    char *dir = bstrto0(NULL, mp_dirname(pattern));
+    bool ok = stat(dir, st) == 0;
+    talloc_free(dir);
+    return ok;
+}
+
+static bool mf_cache_lookup(mf_t *mf, const char *pattern)
+{
+    struct stat st;
+    if (!mf_cache_stat(pattern, &st))
+        return false;
+    bool found = false;
+    pthread_mutex_lock(&mf_cache_lock);
+    for (int n = 0; n < MF_CACHE_ENTRIES && mf_cache[n]; n++) {
+        struct mf_cache_entry *e = mf_cache[n];
+        if (strcmp(e->pattern, pattern) == 0) {
+            if (e->dir_st.st_mtime == st.st_mtime &&
+                e->dir_st.st_ino == st.st_ino)
+            {
+                for (int i = 0; i < e->nr_of_files; i++)
+                    mf_add(mf, e->names[i]);
+                found = true;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mf_cache_lock);
+    return found;
+}
+
+static void mf_cache_store(mf_t *mf, const char *pattern)
+{
+    struct mf_cache_entry *e = talloc_zero(NULL, struct mf_cache_entry);
+    if (!mf_cache_stat(pattern, &e->dir_st)) {
+        talloc_free(e);
+        return;
+    }
+    e->pattern = talloc_strdup(e, pattern);
+    e->nr_of_files = mf->nr_of_files;
+    e->names = talloc_array(e, char *, e->nr_of_files);
+    for (int i = 0; i < e->nr_of_files; i++)
+        e->names[i] = talloc_strdup(e, mf->names[i]);
+
+    pthread_mutex_lock(&mf_cache_lock);
+    int index = MF_CACHE_ENTRIES - 1;
+    for (int n = 0; n < MF_CACHE_ENTRIES && mf_cache[n]; n++) {
+        if (strcmp(mf_cache[n]->pattern, pattern) == 0) {
+            index = n;
+            break;
+        }
+    }
+    talloc_free(mf_cache[index]);
+    memmove(&mf_cache[1], &mf_cache[0], index * sizeof(mf_cache[0]));
+    mf_cache[0] = e;
+    pthread_mutex_unlock(&mf_cache_lock);
+}
+
 mf_t *open_mf_pattern(void *talloc_ctx, struct mp_log *log, char *filename)
 {
 #if defined(HAVE_GLOB) || defined(__MINGW32__)
@@ -105,6 +182,11 @@ mf_t *open_mf_pattern(void *talloc_ctx, struct mp_log *log, char *filename)
         goto exit_mf;
     }
 
+    if (mf_cache_lookup(mf, filename)) {
+        mp_info(log, "number of files: %d (cached)\n", mf->nr_of_files);
+        goto exit_mf;
+    }
+
     char *fname = talloc_size(mf, strlen(filename) + 32);
 
     if (!strchr(filename, '%')) {
@@ -127,6 +209,7 @@ mf_t *open_mf_pattern(void *talloc_ctx, struct mp_log *log, char *filename)
         }
         mp_info(log, "number of files: %d\n", mf->nr_of_files);
         globfree(&gg);
+        mf_cache_store(mf, filename);
         goto exit_mf;
     }
 
@@ -143,6 +226,7 @@ mf_t *open_mf_pattern(void *talloc_ctx, struct mp_log *log, char *filename)
     }
 
     mp_info(log, "number of files: %d\n", mf->nr_of_files);
+    mf_cache_store(mf, filename);
 
 exit_mf:
     return mf;
@@ -32,6 +32,7 @@ typedef struct mf {
     char **names;
     // optional
     struct stream **streams;
+    struct mf_prefetch *prefetch; // demux_mf.c internal
 } mf_t;
 
 mf_t *open_mf_pattern(void *talloc_ctx, struct mp_log *log, char *filename);
@@ -0,0 +1,168 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "compat/atomics.h"
+#include "packet_pool.h"
+
+// Size classes go from 1 << MIN_SHIFT to 1 << MAX_SHIFT bytes, with 4 classes
+// per power of 2 (so at most 25% of a buffer is wasted). Larger buffers are
+// allocated exactly and never cached.
+#define MIN_SHIFT 8
+#define MAX_SHIFT 22
+#define NUM_CLASSES ((MAX_SHIFT - MIN_SHIFT) * 4 + 1)
+
+// Maximum memory kept on the free lists.
+#define POOL_MAX_BYTES (32 * 1024 * 1024)
+
+// Placed in front of each buffer. HEADER_SIZE keeps the buffer as aligned as
+// the malloc() result.
+struct pool_block {
+    size_t capacity;
+    struct pool_block *next;
+    int refcount;
+};
+#define HEADER_SIZE 32
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pool_block *free_lists[NUM_CLASSES];
+static struct packet_pool_stats pool_stats;
+
+static size_t class_size(int c)
+{
+    return (size_t)(4 + c % 4) << (MIN_SHIFT - 2 + c / 4);
+}
+
+// Return the smallest class that can hold size bytes, or -1 if too large.
+static int size_to_class(size_t size)
+{
+    if (size <= ((size_t)1 << MIN_SHIFT))
+        return 0;
+    if (size > ((size_t)1 << MAX_SHIFT))
+        return -1;
+    int b = 0; // 1 << b < size <= 1 << (b + 1)
+    while (((size_t)2 << b) < size)
+        b++;
+    size_t step = (size_t)1 << (b - 2);
+    int k = (size - ((size_t)1 << b) + step - 1) / step;
+    return (b - MIN_SHIFT) * 4 + k;
+}
+
+static struct pool_block *get_block(void *buf)
+{
+    return (struct pool_block *)((char *)buf - HEADER_SIZE);
+}
+
+void *packet_pool_alloc(size_t size)
+{
+    int c = size_to_class(size);
+    size_t capacity = c >= 0 ? class_size(c) : size;
+    struct pool_block *block = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_stats.allocs++;
+    if (c >= 0 && free_lists[c]) {
+        block = free_lists[c];
+        free_lists[c] = block->next;
+        pool_stats.hits++;
+        pool_stats.cached_bytes -= capacity;
+        pool_stats.cached_buffers--;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!block) {
+        block = malloc(HEADER_SIZE + capacity);
+        if (!block) {
+            fprintf(stderr, "Memory allocation failure!\n");
+            abort();
+        }
+        block->capacity = capacity;
+    }
+    block->next = NULL;
+    block->refcount = 1;
+    return (char *)block + HEADER_SIZE;
+}
+
+void *packet_pool_ref(void *buf)
+{
+    mp_atomic_add_and_fetch(&get_block(buf)->refcount, 1);
+    return buf;
+}
+
+bool packet_pool_is_shared(void *buf)
+{
+    struct pool_block *block = get_block(buf);
+    mp_memory_barrier();
+    return block->refcount > 1;
+}
+
+void packet_pool_free(void *buf)
+{
+    if (!buf)
+        return;
+    struct pool_block *block = get_block(buf);
+    if (mp_atomic_add_and_fetch(&block->refcount, -1) > 0)
+        return;
+    int c = size_to_class(block->capacity);
+
+    pthread_mutex_lock(&pool_lock);
+    pool_stats.frees++;
+    if (c >= 0 && class_size(c) == block->capacity &&
+        pool_stats.cached_bytes + block->capacity <= POOL_MAX_BYTES)
+    {
+        block->next = free_lists[c];
+        free_lists[c] = block;
+        pool_stats.cached_bytes += block->capacity;
+        pool_stats.cached_buffers++;
+        block = NULL;
+    } else {
+        pool_stats.discards++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    free(block);
+}
+
+size_t packet_pool_capacity(void *buf)
+{
+    return get_block(buf)->capacity;
+}
+
+void packet_pool_get_stats(struct packet_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool_lock);
+    *stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void packet_pool_flush(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        while (free_lists[c]) {
+            struct pool_block *block = free_lists[c];
+            free_lists[c] = block->next;
+            free(block);
+        }
+    }
+    pool_stats.cached_bytes = 0;
+    pool_stats.cached_buffers = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
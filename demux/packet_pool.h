@@ -0,0 +1,56 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_PACKET_POOL_H
+#define MPLAYER_PACKET_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Process-wide cache of packet payload buffers. Freed buffers are kept on
+// per-size-class free lists, so that the steady stream of similarly sized
+// packets produced by a demuxer doesn't go through malloc/free every time.
+// Buffers are reference counted, so that several packets can point into the
+// same buffer. All functions are thread-safe.
+
+struct packet_pool_stats {
+    int64_t allocs;         // packet_pool_alloc() calls
+    int64_t hits;           // allocations served from a free list
+    int64_t frees;          // packet_pool_free() calls
+    int64_t discards;       // freed buffers released instead of cached
+    int64_t cached_bytes;   // memory currently held on the free lists
+    int64_t cached_buffers;
+};
+
+// Return a buffer with at least size bytes, and a reference count of 1.
+// Never returns NULL.
+void *packet_pool_alloc(size_t size);
+// Add a reference. Returns buf.
+void *packet_pool_ref(void *buf);
+// Remove a reference; the buffer is recycled when the last one is gone.
+void packet_pool_free(void *buf);
+// Whether there is more than one reference.
+bool packet_pool_is_shared(void *buf);
+// Usable size of a buffer returned by packet_pool_alloc().
+size_t packet_pool_capacity(void *buf);
+
+void packet_pool_get_stats(struct packet_pool_stats *stats);
+// Release all cached buffers.
+void packet_pool_flush(void);
+
+#endif /* MPLAYER_PACKET_POOL_H */
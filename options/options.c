@@ -253,8 +253,16 @@ const m_option_t mp_opts[] = {
                       OPTDEF_INT(320)),
     OPT_FLOATRANGE("cache-min", stream_cache_min_percent, 0, 0, 99),
     OPT_FLOATRANGE("cache-seek-min", stream_cache_seek_min_percent, 0, 0, 99),
+    OPT_DOUBLE("cache-secs", stream_cache_secs, CONF_MIN, 0),
     OPT_CHOICE_OR_INT("cache-pause", stream_cache_pause, 0,
                       0, 40, ({"no", -1})),
+    OPT_STRING("cache-file", stream_cache_file, 0),
+    OPT_CHOICE_OR_INT("cache-persistent", stream_cache_persist, 0,
+                      1024, 0x7fffffff, ({"no", 0})),
+    OPT_STRING("cache-persistent-dir", stream_cache_persist_dir, 0),
+    OPT_CHOICE_OR_INT("file-readahead", file_readahead, 0, 256, 0x7fffffff,
+                      ({"no", 0})),
+    OPT_FLAG("file-direct-io", file_direct_io, 0),
 
     {"cdrom-device", &cdrom_device, CONF_TYPE_STRING, 0, 0, 0, NULL},
 #if HAVE_DVDREAD || HAVE_DVDNAV
@@ -327,6 +335,12 @@ const m_option_t mp_opts[] = {
     OPT_STRING("demuxer", demuxer_name, 0),
     OPT_STRING("audio-demuxer", audio_demuxer_name, 0),
     OPT_STRING("sub-demuxer", sub_demuxer_name, 0),
+    OPT_FLAG("demuxer-thread", demuxer_thread, 0),
+    OPT_CHOICE_OR_INT("demuxer-back-buffer", demuxer_back_buffer, 0,
+                      1, 0x7fffffff, ({"no", 0})),
+    OPT_DOUBLE("demuxer-back-buffer-secs", demuxer_back_buffer_secs, CONF_MIN, 0),
+    OPT_DOUBLE("demuxer-readahead-secs", demuxer_readahead_secs, M_OPT_RANGE,
+               .min = 0, .max = 60),
 
     {"mf", (void *) mfopts_conf, CONF_TYPE_SUBCONFIG, 0,0,0, NULL},
 #if HAVE_RADIO
@@ -371,6 +385,9 @@ const m_option_t mp_opts[] = {
 
     OPT_STRING("ad", audio_decoders, 0),
     OPT_STRING("vd", video_decoders, 0),
+    OPT_CHOICE_OR_INT("vd-queue", vd_queue, 0, 1, 100, ({"no", 0})),
+    OPT_INTRANGE("image-buffer-cache", image_buffer_cache, 0, 0, 16384),
+    OPT_FLAG("image-buffer-hugepages", image_buffer_hugepages, 0),
 
     OPT_FLAG("ad-spdif-dtshd", dtshd, 0),
     OPT_FLAG("dtshd", dtshd, 0), // old alias
@@ -404,6 +421,7 @@ const m_option_t mp_opts[] = {
 
     OPT_FLAG("demuxer-mkv-subtitle-preroll", mkv_subtitle_preroll, 0),
     OPT_FLAG("mkv-subtitle-preroll", mkv_subtitle_preroll, 0), // old alias
+    OPT_FLAG("demuxer-mkv-index-cache", mkv_index_cache, 0),
 
 // ------------------------- subtitles options --------------------
 
@@ -589,6 +607,7 @@ const m_option_t mp_opts[] = {
     OPT_CHOICE("hr-seek", hr_seek, 0,
                ({"no", -1}, {"absolute", 0}, {"always", 1}, {"yes", 1})),
     OPT_FLOATRANGE("hr-seek-demuxer-offset", hr_seek_demuxer_offset, 0, -9, 99),
+    OPT_FLAG("hr-seek-fast-decode", hr_seek_fast_decode, 0),
     OPT_CHOICE_OR_INT("autosync", autosync, 0, 0, 10000,
                       ({"no", -1})),
 
@@ -699,6 +718,9 @@ const struct MPOpts mp_default_opts = {
     .stream_cache_min_percent = 20.0,
     .stream_cache_seek_min_percent = 50.0,
     .stream_cache_pause = 10.0,
+    .demuxer_back_buffer_secs = 10.0,
+    .demuxer_readahead_secs = 0.5,
+    .image_buffer_cache = 128,
     .network_rtsp_transport = 2,
     .chapterrange = {-1, -1},
     .edition_id = -1,
@@ -755,6 +777,7 @@ const struct MPOpts mp_default_opts = {
         .allow_mimetype = 1,
     },
     .lavc_param = {
+        .threads = -1,
         .show_all = 1,
         .check_hw_profile = 1,
     },
@@ -87,6 +87,9 @@ typedef struct MPOpts {
 
     char *audio_decoders;
     char *video_decoders;
+    int vd_queue;
+    int image_buffer_cache;
+    int image_buffer_hugepages;
 
     int osd_level;
     int osd_duration;
@@ -109,6 +112,12 @@ typedef struct MPOpts {
     int stream_cache_def_size;
     float stream_cache_min_percent;
     float stream_cache_seek_min_percent;
+    double stream_cache_secs;
+    char *stream_cache_file;
+    int stream_cache_persist;
+    char *stream_cache_persist_dir;
+    int file_readahead;
+    int file_direct_io;
     int network_rtsp_transport;
     int stream_cache_pause;
     int chapterrange[2];
@@ -118,6 +127,7 @@ typedef struct MPOpts {
     int initial_audio_sync;
     int hr_seek;
     float hr_seek_demuxer_offset;
+    int hr_seek_fast_decode;
     float audio_delay;
     float default_max_pts_correction;
     int autosync;
@@ -168,7 +178,12 @@ typedef struct MPOpts {
     char *demuxer_name;
     char *audio_demuxer_name;
     char *sub_demuxer_name;
+    int demuxer_thread;
+    int demuxer_back_buffer;
+    double demuxer_back_buffer_secs;
+    double demuxer_readahead_secs;
     int mkv_subtitle_preroll;
+    int mkv_index_cache;
 
     struct image_writer_opts *screenshot_image_opts;
     char *screenshot_template;
@@ -233,6 +248,7 @@ typedef struct MPOpts {
         char *skip_idct_str;
         char *skip_frame_str;
         int threads;
+        int thread_type;
         int bitexact;
         int check_hw_profile;
         char *avopt;
@@ -255,6 +271,7 @@ typedef struct MPOpts {
         char *cryptokey;
         char *avopt;
         int genptsmode;
+        int probe_cache;
     } lavfdopts;
 
     struct input_conf {
@@ -36,6 +36,8 @@
 #include "input/input.h"
 #include "stream/stream.h"
 #include "demux/demux.h"
+#include "demux/packet_pool.h"
+#include "video/image_buffer.h"
 #include "demux/stheader.h"
 #include "stream/resolve/resolve.h"
 #include "common/playlist.h"
@@ -213,7 +215,9 @@ static int mp_property_stream_capture(m_option_t *prop, int action,
 
     if (action == M_PROPERTY_SET) {
         char *filename = *(char **)arg;
+        demux_pause(mpctx->demuxer);
         stream_set_capture_file(mpctx->stream, filename);
+        demux_unpause(mpctx->demuxer);
         // fall through to mp_property_generic_option
     }
     return mp_property_generic_option(prop, action, arg, mpctx);
@@ -238,10 +242,14 @@ static int mp_property_stream_pos(m_option_t *prop, int action, void *arg,
         return M_PROPERTY_UNAVAILABLE;
     switch (action) {
     case M_PROPERTY_GET:
+        demux_pause(mpctx->demuxer);
         *(int64_t *) arg = stream_tell(stream);
+        demux_unpause(mpctx->demuxer);
         return M_PROPERTY_OK;
     case M_PROPERTY_SET:
+        demux_pause(mpctx->demuxer);
         stream_seek(stream, *(int64_t *) arg);
+        demux_unpause(mpctx->demuxer);
         return M_PROPERTY_OK;
     }
     return M_PROPERTY_NOT_IMPLEMENTED;
@@ -611,8 +619,8 @@ static int mp_property_titles(m_option_t *prop, int action, void *arg,
 {
     struct demuxer *demuxer = mpctx->master_demuxer;
     unsigned int num_titles;
-    if (!demuxer || stream_control(demuxer->stream, STREAM_CTRL_GET_NUM_TITLES,
-                                   &num_titles) < 1)
+    if (!demuxer || demux_stream_control(demuxer, STREAM_CTRL_GET_NUM_TITLES,
+                                         &num_titles) < 1)
         return M_PROPERTY_UNAVAILABLE;
     return m_property_int_ro(prop, action, arg, num_titles);
 }
@@ -784,6 +792,149 @@ static int mp_property_cache(m_option_t *prop, int action, void *arg,
     return m_property_int_ro(prop, action, arg, cache);
 }
 
+static int get_cache_stats(MPContext *mpctx, struct stream_cache_stats *st)
+{
+    if (!mpctx->stream)
+        return M_PROPERTY_UNAVAILABLE;
+    if (stream_control(mpctx->stream, STREAM_CTRL_GET_CACHE_STATS, st) < 1)
+        return M_PROPERTY_UNAVAILABLE;
+    return M_PROPERTY_OK;
+}
+
+static int mp_property_cache_read_rate(m_option_t *prop, int action,
+                                       void *arg, MPContext *mpctx)
+{
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int64_ro(prop, action, arg, st.read_rate);
+}
+
+static int mp_property_cache_read_latency(m_option_t *prop, int action,
+                                          void *arg, MPContext *mpctx)
+{
+    static const int limits[] = STREAM_CACHE_LATENCY_LIMITS;
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    char *res = talloc_strdup(NULL, "");
+    for (int n = 0; n < STREAM_CACHE_LATENCY_BUCKETS; n++) {
+        if (n < MP_ARRAY_SIZE(limits)) {
+            res = talloc_asprintf_append(res, "<%dms=%"PRId64" ", limits[n],
+                                         st.read_latency[n]);
+        } else {
+            res = talloc_asprintf_append(res, ">=%dms=%"PRId64, limits[n - 1],
+                                         st.read_latency[n]);
+        }
+    }
+    int r = m_property_strdup_ro(prop, action, arg, res);
+    talloc_free(res);
+    return r;
+}
+
+static int mp_property_cache_stalls(m_option_t *prop, int action, void *arg,
+                                    MPContext *mpctx)
+{
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int64_ro(prop, action, arg, st.waits);
+}
+
+static int mp_property_cache_stall_time(m_option_t *prop, int action,
+                                        void *arg, MPContext *mpctx)
+{
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_double_ro(prop, action, arg, st.wait_time);
+}
+
+static int mp_property_cache_seeks(m_option_t *prop, int action, void *arg,
+                                   MPContext *mpctx)
+{
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int64_ro(prop, action, arg, st.seeks);
+}
+
+static int mp_property_cache_discarded(m_option_t *prop, int action,
+                                       void *arg, MPContext *mpctx)
+{
+    struct stream_cache_stats st;
+    if (get_cache_stats(mpctx, &st) != M_PROPERTY_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int64_ro(prop, action, arg, st.discarded);
+}
+
+static int mp_property_packet_pool_allocs(m_option_t *prop, int action,
+                                          void *arg, MPContext *mpctx)
+{
+    struct packet_pool_stats st;
+    packet_pool_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.allocs);
+}
+
+static int mp_property_packet_pool_hits(m_option_t *prop, int action,
+                                        void *arg, MPContext *mpctx)
+{
+    struct packet_pool_stats st;
+    packet_pool_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.hits);
+}
+
+static int mp_property_packet_pool_cached(m_option_t *prop, int action,
+                                          void *arg, MPContext *mpctx)
+{
+    struct packet_pool_stats st;
+    packet_pool_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.cached_bytes);
+}
+
+static int mp_property_image_buffer_allocs(m_option_t *prop, int action,
+                                           void *arg, MPContext *mpctx)
+{
+    struct mp_image_buffer_stats st;
+    mp_image_buffer_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.allocs);
+}
+
+static int mp_property_image_buffer_hits(m_option_t *prop, int action,
+                                         void *arg, MPContext *mpctx)
+{
+    struct mp_image_buffer_stats st;
+    mp_image_buffer_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.hits);
+}
+
+static int mp_property_image_buffer_cached(m_option_t *prop, int action,
+                                           void *arg, MPContext *mpctx)
+{
+    struct mp_image_buffer_stats st;
+    mp_image_buffer_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.cached_bytes);
+}
+
+static int mp_property_image_buffer_used(m_option_t *prop, int action,
+                                         void *arg, MPContext *mpctx)
+{
+    struct mp_image_buffer_stats st;
+    mp_image_buffer_get_stats(&st);
+    return m_property_int64_ro(prop, action, arg, st.used_bytes);
+}
+
+static int mp_property_demuxer_cache_duration(m_option_t *prop, int action,
+                                              void *arg, MPContext *mpctx)
+{
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+    double secs = demux_get_buffered_secs(mpctx->demuxer);
+    if (secs < 0)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_double_ro(prop, action, arg, secs);
+}
+
 static int mp_property_clock(m_option_t *prop, int action, void *arg,
                              MPContext *mpctx)
 {
@@ -1929,6 +2080,21 @@ static const m_option_t mp_properties[] = {
     { "chapter-metadata", mp_property_chapter_metadata, CONF_TYPE_STRING_LIST },
     M_OPTION_PROPERTY_CUSTOM("pause", mp_property_pause),
     { "cache", mp_property_cache, CONF_TYPE_INT },
+    { "cache-read-rate", mp_property_cache_read_rate, CONF_TYPE_INT64 },
+    { "cache-read-latency", mp_property_cache_read_latency, CONF_TYPE_STRING },
+    { "cache-stalls", mp_property_cache_stalls, CONF_TYPE_INT64 },
+    { "cache-stall-time", mp_property_cache_stall_time, CONF_TYPE_DOUBLE },
+    { "cache-seeks", mp_property_cache_seeks, CONF_TYPE_INT64 },
+    { "cache-discarded", mp_property_cache_discarded, CONF_TYPE_INT64 },
+    { "packet-pool-allocs", mp_property_packet_pool_allocs, CONF_TYPE_INT64 },
+    { "packet-pool-hits", mp_property_packet_pool_hits, CONF_TYPE_INT64 },
+    { "packet-pool-cached", mp_property_packet_pool_cached, CONF_TYPE_INT64 },
+    { "image-buffer-allocs", mp_property_image_buffer_allocs, CONF_TYPE_INT64 },
+    { "image-buffer-hits", mp_property_image_buffer_hits, CONF_TYPE_INT64 },
+    { "image-buffer-cached", mp_property_image_buffer_cached, CONF_TYPE_INT64 },
+    { "image-buffer-used", mp_property_image_buffer_used, CONF_TYPE_INT64 },
+    { "demuxer-cache-duration", mp_property_demuxer_cache_duration,
+      CONF_TYPE_DOUBLE },
     M_OPTION_PROPERTY("pts-association-mode"),
     M_OPTION_PROPERTY("hr-seek"),
     { "clock", mp_property_clock, CONF_TYPE_STRING,
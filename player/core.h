@@ -233,6 +233,9 @@ typedef struct MPContext {
     bool hrseek_active;
     bool hrseek_framedrop;
     double hrseek_pts;
+    // Decode video packets before this pts with reduced quality, or
+    // MP_NOPTS_VALUE (--hr-seek-fast-decode).
+    double hrseek_fastdec_pts;
     // AV sync: the next frame should be shown when the audio out has this
     // much (in seconds) buffered data left. Increased when more data is
     // written to the ao, decreased when moving to the next frame.
@@ -250,6 +253,9 @@ typedef struct MPContext {
     // Set to true some time after a new frame has been shown, and it turns out
     // that this frame was the last one before video ends.
     bool playing_last_frame;
+    // Set if update_video() is waiting for the decoder thread to output a
+    // frame. The thread wakes up the playloop when it has one.
+    bool waiting_for_decoder;
     // How much video timing has been changed to make it match the audio
     // timeline. Used for status line information only.
     double total_avsync_change;
@@ -289,6 +295,10 @@ typedef struct MPContext {
     double last_heartbeat;
     double last_metadata_update;
 
+    // Start of the current media bitrate measurement (--cache-secs)
+    double cache_rate_pts;
+    int64_t cache_rate_pos;
+
     double mouse_timer;
     unsigned int mouse_event_ts;
     bool mouse_cursor_visible;
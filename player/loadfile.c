@@ -463,8 +463,18 @@ static struct track *add_stream_track(struct MPContext *mpctx,
 
 void add_demuxer_tracks(struct MPContext *mpctx, struct demuxer *demuxer)
 {
+    int num_tracks = 0;
+    for (int n = 0; n < mpctx->num_tracks; n++) {
+        struct track *track = mpctx->tracks[n];
+        num_tracks += track->demuxer == demuxer && track->stream;
+    }
+    if (num_tracks == demuxer->num_streams)
+        return;
+    // A demuxer thread might still be initializing the new streams.
+    demux_pause(demuxer);
     for (int n = 0; n < demuxer->num_streams; n++)
         add_stream_track(mpctx, demuxer->streams[n], !!mpctx->timeline);
+    demux_unpause(demuxer);
 }
 
 static void add_dvd_tracks(struct MPContext *mpctx)
@@ -880,12 +890,32 @@ static bool attachment_is_font(struct mp_log *log, struct demux_attachment *att)
     return false;
 }
 
+// Whether subtitles could use fonts embedded in the sources. Loading the
+// attachments is skipped otherwise, as they can be big.
+static bool need_embedded_fonts(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    if (!opts->use_embedded_fonts)
+        return false;
+    if (opts->sub_name && opts->sub_name[0])
+        return true;
+    for (int j = 0; j < mpctx->num_sources; j++) {
+        struct demuxer *d = mpctx->sources[j];
+        for (int n = 0; n < d->num_streams; n++) {
+            if (d->streams[n]->type == STREAM_SUB)
+                return true;
+        }
+    }
+    return false;
+}
+
 static void add_subtitle_fonts_from_sources(struct MPContext *mpctx)
 {
 #if HAVE_LIBASS
-    if (mpctx->opts->ass_enabled) {
+    if (mpctx->opts->ass_enabled && need_embedded_fonts(mpctx)) {
         for (int j = 0; j < mpctx->num_sources; j++) {
             struct demuxer *d = mpctx->sources[j];
+            demux_control(d, DEMUXER_CTRL_LOAD_ATTACHMENTS, NULL);
             for (int i = 0; i < d->num_attachments; i++) {
                 struct demux_attachment *att = d->attachments + i;
                 if (mpctx->opts->use_embedded_fonts &&
@@ -1271,6 +1301,9 @@ goto_reopen_demuxer: ;
 
     MP_VERBOSE(mpctx, "Starting playback...\n");
 
+    if (opts->demuxer_thread && !mpctx->timeline)
+        demux_start_thread(mpctx->demuxer);
+
     mpctx->drop_frame_cnt = 0;
     mpctx->dropped_frames = 0;
     mpctx->max_frames = opts->play_frames;
@@ -1286,9 +1319,11 @@ goto_reopen_demuxer: ;
     mpctx->video_pts = 0;
     mpctx->last_vo_pts = MP_NOPTS_VALUE;
     mpctx->last_seek_pts = 0;
+    mpctx->cache_rate_pts = MP_NOPTS_VALUE;
     mpctx->playback_pts = MP_NOPTS_VALUE;
     mpctx->hrseek_active = false;
     mpctx->hrseek_framedrop = false;
+    mpctx->hrseek_fastdec_pts = MP_NOPTS_VALUE;
     mpctx->step_frames = 0;
     mpctx->backstep_active = false;
     mpctx->total_avsync_change = 0;
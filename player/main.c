@@ -53,6 +53,7 @@
 #include "audio/out/ao.h"
 #include "audio/mixer.h"
 #include "demux/demux.h"
+#include "demux/packet_pool.h"
 #include "stream/stream.h"
 #include "sub/ass_mp.h"
 #include "sub/osd.h"
@@ -109,6 +110,7 @@ static MP_NORETURN void exit_player(struct MPContext *mpctx,
 {
     int rc;
     uninit_player(mpctx, INITIALIZED_ALL);
+    packet_pool_flush();
 
 #if HAVE_ENCODING
     encode_lavc_finish(mpctx->encode_lavc_ctx);
@@ -109,6 +109,9 @@ double get_start_time(struct MPContext *mpctx)
     return demuxer_get_start_time(demuxer);
 }
 
+// The cache answers the cache status controls under its own lock, without
+// touching the read position, so they can be used while the demuxer thread
+// reads the stream.
 int mp_get_cache_percent(struct MPContext *mpctx)
 {
     if (mpctx->stream) {
@@ -43,6 +43,7 @@
 #include "demux/demux.h"
 #include "stream/stream.h"
 #include "sub/osd.h"
+#include "video/image_buffer.h"
 #include "video/filter/vf.h"
 #include "video/decode/dec_video.h"
 #include "video/out/vo.h"
@@ -193,10 +194,12 @@ static void seek_reset(struct MPContext *mpctx, bool reset_ao)
     mpctx->restart_playback = true;
     mpctx->hrseek_active = false;
     mpctx->hrseek_framedrop = false;
+    mpctx->hrseek_fastdec_pts = MP_NOPTS_VALUE;
     mpctx->total_avsync_change = 0;
     mpctx->drop_frame_cnt = 0;
     mpctx->dropped_frames = 0;
     mpctx->playback_pts = MP_NOPTS_VALUE;
+    mpctx->cache_rate_pts = MP_NOPTS_VALUE;
 
 #if HAVE_ENCODING
     encode_lavc_discontinuity(mpctx->encode_lavc_ctx);
@@ -344,6 +347,8 @@ static int mp_seek(MPContext *mpctx, struct seek_params seek,
         mpctx->hrseek_framedrop = true;
         mpctx->hrseek_pts = hr_seek ? seek.amount
                                  : mpctx->timeline[mpctx->timeline_part].start;
+        if (hr_seek && opts->hr_seek_fast_decode)
+            mpctx->hrseek_fastdec_pts = mpctx->hrseek_pts;
     }
 
     mpctx->start_timestamp = mp_time_sec();
@@ -456,8 +461,7 @@ double get_current_pos_ratio(struct MPContext *mpctx, bool use_range)
     } else {
         struct stream *s = demuxer->stream;
         int64_t size = s->end_pos - s->start_pos;
-        int64_t fpos = demuxer->filepos >= 0 ?
-                       demuxer->filepos : stream_tell(demuxer->stream);
+        int64_t fpos = demux_get_filepos(demuxer);
         if (size > 0)
             ans = MPCLAMP((double)(fpos - s->start_pos) / size, 0, 1);
     }
@@ -688,6 +692,34 @@ static void handle_pause_on_low_cache(struct MPContext *mpctx)
     }
 }
 
+// Measure the media bitrate as the amount of data read from the stream per
+// second of playback, and pass it to the cache (for --cache-secs).
+static void handle_cache_bitrate(struct MPContext *mpctx)
+{
+    struct demuxer *demuxer = mpctx->master_demuxer;
+    if (!mpctx->opts->stream_cache_secs || !demuxer || mpctx->paused)
+        return;
+    double pts = get_current_time(mpctx);
+    if (pts == MP_NOPTS_VALUE)
+        return;
+    int64_t pos = demux_get_filepos(demuxer);
+    if (mpctx->cache_rate_pts == MP_NOPTS_VALUE ||
+        pts < mpctx->cache_rate_pts || pos < mpctx->cache_rate_pos)
+    {
+        mpctx->cache_rate_pts = pts;
+        mpctx->cache_rate_pos = pos;
+        return;
+    }
+    double duration = pts - mpctx->cache_rate_pts;
+    if (duration < 5.0)
+        return;
+    double rate = (pos - mpctx->cache_rate_pos) / duration;
+    if (rate > 0)
+        demux_stream_control(demuxer, STREAM_CTRL_SET_CACHE_BITRATE, &rate);
+    mpctx->cache_rate_pts = pts;
+    mpctx->cache_rate_pos = pos;
+}
+
 static void handle_heartbeat_cmd(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -831,6 +863,9 @@ static void handle_backstep(struct MPContext *mpctx)
                     mpctx->hrseek_pts = current_pts + 10.0;
                     mpctx->hrseek_framedrop = false;
                     mpctx->backstep_active = true;
+                    // The frames up to current_pts are only indexed.
+                    if (mpctx->opts->hr_seek_fast_decode)
+                        mpctx->hrseek_fastdec_pts = current_pts;
                 }
             } else {
                 mpctx->backstep_active = true;
@@ -1048,7 +1083,8 @@ void run_playloop(struct MPContext *mpctx)
         if (!video_left || (mpctx->paused && !mpctx->restart_playback))
             break;
         if (!vo->frame_loaded && !mpctx->playing_last_frame) {
-            sleeptime = 0;
+            if (!mpctx->waiting_for_decoder)
+                sleeptime = 0;
             break;
         }
 
@@ -1295,6 +1331,11 @@ void run_playloop(struct MPContext *mpctx)
 
     handle_pause_on_low_cache(mpctx);
 
+    handle_cache_bitrate(mpctx);
+
+    // Release unused image buffers while paused, or after video has ended.
+    mp_image_buffer_trim();
+
     handle_input_and_seek_coalesce(mpctx);
 
     handle_backstep(mpctx);
@@ -1330,6 +1371,7 @@ void idle_loop(struct MPContext *mpctx)
             vo_check_events(mpctx->video_out);
         update_osd_msg(mpctx);
         handle_osd_redraw(mpctx);
+        mp_image_buffer_trim();
         mp_cmd_t *cmd = mp_input_get_cmd(mpctx->input,
                                          get_wakeup_period(mpctx) * 1000,
                                          false);
@@ -32,10 +32,12 @@
 #include "options/m_property.h"
 
 #include "audio/out/ao.h"
+#include "input/input.h"
 #include "demux/demux.h"
 #include "stream/stream.h"
 #include "sub/osd.h"
 #include "video/hwdec.h"
+#include "video/image_buffer.h"
 #include "video/filter/vf.h"
 #include "video/decode/dec_video.h"
 #include "video/decode/vd.h"
@@ -145,6 +147,12 @@ int reinit_video_filters(struct MPContext *mpctx)
     return d_video->vfilter && d_video->vfilter->initialized > 0 ? 0 : -1;
 }
 
+static void wakeup_playloop(void *ctx)
+{
+    struct MPContext *mpctx = ctx;
+    mp_input_wakeup(mpctx->input);
+}
+
 int reinit_video_chain(struct MPContext *mpctx)
 {
     struct MPOpts *opts = mpctx->opts;
@@ -176,6 +184,9 @@ int reinit_video_chain(struct MPContext *mpctx)
 
     update_window_title(mpctx, true);
 
+    mp_image_buffer_set_config(opts->image_buffer_cache * 1024LL * 1024,
+                               opts->image_buffer_hugepages);
+
     struct dec_video *d_video = talloc_zero(NULL, struct dec_video);
     mpctx->d_video = d_video;
     d_video->global = mpctx->global;
@@ -184,11 +195,13 @@ int reinit_video_chain(struct MPContext *mpctx)
     d_video->header = sh;
     d_video->fps = sh->video->fps;
     d_video->vo = mpctx->video_out;
+    d_video->wakeup_cb = wakeup_playloop;
+    d_video->wakeup_ctx = mpctx;
     mpctx->initialized_flags |= INITIALIZED_VCODEC;
 
     vo_control(mpctx->video_out, VOCTRL_GET_HWDEC_INFO, &d_video->hwdec_info);
 
-    if (stream_control(sh->demuxer->stream, STREAM_CTRL_GET_ASPECT_RATIO, &ar)
+    if (demux_stream_control(sh->demuxer, STREAM_CTRL_GET_ASPECT_RATIO, &ar)
             != STREAM_UNSUPPORTED)
         d_video->stream_aspect = ar;
 
@@ -374,11 +387,84 @@ static double update_video_attached_pic(struct MPContext *mpctx)
     return 0;
 }
 
+// With --hr-seek-fast-decode, number of frames before the hr-seek target that
+// are decoded normally. This avoids degrading the reference frames the target
+// frame is predicted from most directly.
+#define HRSEEK_FULL_DECODE_FRAMES 8
+
+// Read a packet for the decoder, and decide whether its frame can be dropped.
+// If check_drop is false, the A/V sync based frame dropping is skipped.
+static struct demux_packet *read_video_packet(struct MPContext *mpctx,
+                                              int *framedrop_type,
+                                              bool check_drop)
+{
+    struct dec_video *d_video = mpctx->d_video;
+
+    struct demux_packet *pkt = demux_read_packet(d_video->header);
+    if (pkt && pkt->pts != MP_NOPTS_VALUE)
+        pkt->pts += mpctx->video_offset;
+    bool broken_pts = video_get_broken_packet_pts(d_video);
+    if ((pkt && pkt->pts >= mpctx->hrseek_pts - .005) || broken_pts)
+        mpctx->hrseek_framedrop = false;
+    *framedrop_type = 0;
+    if (mpctx->hrseek_active && mpctx->hrseek_framedrop)
+        *framedrop_type = 1;
+    else if (check_drop)
+        *framedrop_type = check_framedrop(mpctx, -1);
+
+    // Decode with reduced quality until shortly before the hr-seek target.
+    // Packets are in decoding order, so once one reaches the end of that
+    // range, decode everything after it normally.
+    if (mpctx->hrseek_fastdec_pts != MP_NOPTS_VALUE) {
+        double fps = d_video->fps > 0 ? d_video->fps : 25;
+        double end = mpctx->hrseek_fastdec_pts - HRSEEK_FULL_DECODE_FRAMES / fps;
+        if (!mpctx->hrseek_active || broken_pts || !pkt ||
+            pkt->pts == MP_NOPTS_VALUE || pkt->pts >= end)
+        {
+            mpctx->hrseek_fastdec_pts = MP_NOPTS_VALUE;
+        } else {
+            *framedrop_type |= VD_FLAG_FAST;
+        }
+    }
+    return pkt;
+}
+
+// Same as the decoding part of update_video(), but using the decoder thread.
+// Returns false on EOF.
+static bool decode_video_async(struct MPContext *mpctx)
+{
+    struct dec_video *d_video = mpctx->d_video;
+
+    while (video_async_can_send(d_video)) {
+        // The A/V delay says nothing about packets that are decoded only
+        // after the ones already queued, so decide about dropping only for
+        // the packet that will be decoded next.
+        bool check_drop = video_async_is_empty(d_video);
+        int framedrop_type;
+        struct demux_packet *pkt =
+            read_video_packet(mpctx, &framedrop_type, check_drop);
+        video_async_send_packet(d_video, pkt, framedrop_type);
+    }
+
+    bool eof;
+    struct mp_image *decoded_frame = video_async_receive_frame(d_video, &eof);
+    mpctx->waiting_for_decoder = !decoded_frame && !eof;
+    if (decoded_frame) {
+        filter_video(mpctx, decoded_frame, false);
+    } else if (eof) {
+        if (!load_next_vo_frame(mpctx, true))
+            return false;
+    }
+    return true;
+}
+
 double update_video(struct MPContext *mpctx, double endpts)
 {
     struct dec_video *d_video = mpctx->d_video;
     struct vo *video_out = mpctx->video_out;
 
+    mpctx->waiting_for_decoder = false;
+
     if (d_video->header->attached_picture)
         return update_video_attached_pic(mpctx);
 
@@ -388,18 +474,14 @@ double update_video(struct MPContext *mpctx, double endpts)
         // Draining on reconfig
         if (!load_next_vo_frame(mpctx, true))
             return -1;
+    } else if (video_async_enabled(d_video)) {
+        if (!decode_video_async(mpctx))
+            return -1;
     } else {
         // Decode a new frame
-        struct demux_packet *pkt = demux_read_packet(d_video->header);
-        if (pkt && pkt->pts != MP_NOPTS_VALUE)
-            pkt->pts += mpctx->video_offset;
-        if ((pkt && pkt->pts >= mpctx->hrseek_pts - .005) ||
-            d_video->has_broken_packet_pts)
-        {
-            mpctx->hrseek_framedrop = false;
-        }
-        int framedrop_type = mpctx->hrseek_active && mpctx->hrseek_framedrop ?
-                             1 : check_framedrop(mpctx, -1);
+        int framedrop_type;
+        struct demux_packet *pkt = read_video_packet(mpctx, &framedrop_type,
+                                                     true);
         struct mp_image *decoded_frame =
             video_decode(d_video, pkt, framedrop_type);
         talloc_free(pkt);
@@ -33,6 +33,13 @@
 // the cache is active.
 #define CACHE_UPDATE_CONTROLS_TIME 2.0
 
+// Time in seconds between log messages with cache statistics (if verbose).
+#define CACHE_STATS_LOG_TIME 10.0
+
+// With --cache-secs, the time in seconds reading from the source (at the
+// measured speed) may take instead of a seek, when skipping over a gap.
+#define CACHE_SEEK_COST 0.1
+
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,20 +51,41 @@
 #include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
+#include <fcntl.h>
 
 #include <libavutil/common.h>
 
 #include "config.h"
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #include "osdep/timer.h"
 #include "osdep/threads.h"
+#include "compat/atomics.h"
 
 #include "common/msg.h"
+#include "options/options.h"
 
 #include "stream.h"
+#include "cache_store.h"
 #include "common/common.h"
 
 
+// The buffer is split into blocks of block_size bytes. Each block caches data
+// from one block_size-aligned "slot" of the file. Blocks are assigned to slots
+// on demand, and the least recently used block is recycled if the buffer is
+// full. This way the cache can hold multiple disjoint byte ranges of the file,
+// e.g. the data around the previous playback position after a seek.
+struct cache_block {
+    int64_t pos;            // file position of the first cached byte (or -1)
+    int len;                // number of cached bytes (pos..pos+len)
+    int hash_next;          // next block in the same hash bucket, or -1
+    int pins;               // number of borrowed views (block can't be reused)
+    int lru_prev, lru_next; // LRU list, towards least/most recently used
+};
+
 // Note: (struct priv*)(cache->priv)->cache == cache
 struct priv {
     pthread_t cache_thread;
@@ -68,32 +96,55 @@ struct priv {
     // Constants (as long as cache thread is running)
     unsigned char *buffer;  // base pointer of the allocated buffer memory
     int64_t buffer_size;    // size of the allocated buffer memory
-    int64_t back_size;      // keep back_size amount of old bytes for backward seek
-    int64_t fill_limit;     // we should fill buffer only if space>=fill_limit
-    int64_t seek_limit;     // keep filling cache if distance is less that seek limit
+    int64_t block_size;     // size of a cache block (power of 2)
+    int num_blocks;         // buffer_size / block_size
     struct byte_meta *bm;   // additional per-byte metadata
+    size_t mapped_size;     // if >0, buffer and bm are mapped from a file
 
     struct mp_log *log;
 
     // Owned by the main thread
     stream_t *cache;        // wrapper stream, used by demuxer etc.
 
+    // Block the main thread reads from without locking (or -1). Only the main
+    // thread changes it (with the mutex held). The cache thread doesn't free
+    // or reuse this block, and only appends data to it. It updates the block's
+    // len field after writing the data, with a memory barrier in between.
+    // If the cache thread drops the cache contents, it only unlinks the block
+    // and sets fast_block_stale; the main thread releases it.
+    int fast_block;
+    bool fast_block_stale;
+
     // Owned by the cache thread
     stream_t *stream;       // "real" stream, used to read from the source media
+    struct cache_store *store; // persistent cache, or NULL
 
     // All the following members are shared between the threads.
     // You must lock the mutex to access them.
 
-    // Ringbuffer
-    int64_t min_filepos;    // range of file that is cached in the buffer
-    int64_t max_filepos;    // ... max_filepos being the last read position
-    bool eof;               // true if max_filepos = EOF
-    int64_t offset;         // buffer[offset] correponds to max_filepos
+    // Block store
+    struct cache_block *blocks;
+    int *hash;              // slot -> first block index, using hash_mask
+    int hash_mask;
+    int lru_first;          // least recently used block (or -1)
+    int lru_last;           // most recently used block (or -1)
+    int filling;            // block being written by the cache thread (or -1)
+
+    int64_t fill_pos;       // position of the source stream (next read)
+    bool eof;               // true if fill_pos = EOF
+
+    // Limits; adjusted at runtime by update_limits() if target_secs is set
+    int64_t back_size;      // keep back_size amount of old bytes for backward seek
+    int64_t fill_limit;     // we should fill buffer only if space>=fill_limit
+    int64_t seek_limit;     // keep filling cache if distance is less that seek limit
+    double target_secs;     // readahead in seconds of media (or 0)
+    double media_rate;      // media bitrate in bytes/second (or 0 if unknown)
 
     bool idle;              // cache thread has stopped reading
     int64_t reads;          // number of actual read attempts performed
 
-    int64_t read_filepos;   // client read position (mirrors cache->pos)
+    int64_t read_filepos;   // client read position (updated from cache->pos
+                            // whenever the main thread locks the mutex)
     int control;            // requested STREAM_CTRL_... or CACHE_CTRL_...
     void *control_arg;      // temporary for executing STREAM_CTRLs
     int control_res;
@@ -108,6 +159,13 @@ struct priv {
     int stream_cache_idle;
     int stream_cache_fill;
     char **stream_metadata;
+
+    // Statistics (STREAM_CTRL_GET_CACHE_STATS)
+    struct stream_cache_stats stats;
+    int64_t rate_bytes;     // stats.bytes_read at rate_time
+    double rate_time;
+    struct stream_cache_stats logged; // stats at the last log message
+    double log_time;
 };
 
 // Store additional per-byte metadata. Since per-byte would be way too
@@ -119,6 +177,14 @@ struct byte_meta {
 enum {
     BYTE_META_CHUNK_SIZE = 8 * 1024,
 
+    // Block size limits. The block size is chosen depending on the cache size.
+    CACHE_MIN_BLOCK_SIZE = 16 * 1024,
+    CACHE_MAX_BLOCK_SIZE = 1024 * 1024,
+    // Use larger blocks only if there are at least this many of them.
+    CACHE_BLOCKS_TARGET = 64,
+    // Absolute minimum; needed so that eviction always finds a block.
+    CACHE_MIN_BLOCKS = 4,
+
     CACHE_INTERRUPTED = -1,
 
     CACHE_CTRL_NONE = 0,
@@ -126,13 +192,6 @@ enum {
     CACHE_CTRL_PING = -2,
 };
 
-static int64_t mp_clipi64(int64_t val, int64_t min, int64_t max)
-{
-    val = FFMIN(val, max);
-    val = FFMAX(val, min);
-    return val;
-}
-
 // Used by the main thread to wakeup the cache thread, and to wait for the
 // cache thread. The cache mutex has to be locked when calling this function.
 // *retry_time should be set to 0 on the first call.
@@ -154,18 +213,213 @@ static int cache_wakeup_and_wait(struct priv *s, double *retry_time)
     pthread_cond_signal(&s->wakeup);
     mpthread_cond_timed_wait(&s->wakeup, &s->mutex, CACHE_WAIT_TIME);
 
-    *retry_time += mp_time_sec() - start;
+    double waited = mp_time_sec() - start;
+    if (!*retry_time)
+        s->stats.waits++;
+    s->stats.wait_time += waited;
+    *retry_time += waited;
 
     return 0;
 }
 
+static int64_t cache_slot(struct priv *s, int64_t pos)
+{
+    return pos / s->block_size;
+}
+
+static unsigned char *cache_block_ptr(struct priv *s, struct cache_block *b)
+{
+    int64_t index = b - s->blocks;
+    return s->buffer + index * s->block_size + (b->pos % s->block_size);
+}
+
+static void cache_lru_unlink(struct priv *s, struct cache_block *b)
+{
+    if (b->lru_prev >= 0) {
+        s->blocks[b->lru_prev].lru_next = b->lru_next;
+    } else {
+        s->lru_first = b->lru_next;
+    }
+    if (b->lru_next >= 0) {
+        s->blocks[b->lru_next].lru_prev = b->lru_prev;
+    } else {
+        s->lru_last = b->lru_prev;
+    }
+    b->lru_prev = b->lru_next = -1;
+}
+
+// Mark the block as most recently used.
+static void cache_lru_touch(struct priv *s, struct cache_block *b)
+{
+    int index = b - s->blocks;
+    if (s->lru_last == index)
+        return;
+    cache_lru_unlink(s, b);
+    b->lru_prev = s->lru_last;
+    if (s->lru_last >= 0) {
+        s->blocks[s->lru_last].lru_next = index;
+    } else {
+        s->lru_first = index;
+    }
+    s->lru_last = index;
+}
+
+// Return the block assigned to the slot pos falls into, or NULL.
+static struct cache_block *cache_find_slot(struct priv *s, int64_t pos)
+{
+    int64_t slot = cache_slot(s, pos);
+    for (int i = s->hash[slot & s->hash_mask]; i >= 0; i = s->blocks[i].hash_next)
+    {
+        struct cache_block *b = &s->blocks[i];
+        if (cache_slot(s, b->pos) == slot)
+            return b;
+    }
+    return NULL;
+}
+
+// Return the block which contains the byte at pos, or NULL if not cached.
+static struct cache_block *cache_find_block(struct priv *s, int64_t pos)
+{
+    struct cache_block *b = cache_find_slot(s, pos);
+    if (b && pos >= b->pos && pos < b->pos + b->len)
+        return b;
+    return NULL;
+}
+
+static void cache_hash_unlink(struct priv *s, struct cache_block *b)
+{
+    int *link = &s->hash[cache_slot(s, b->pos) & s->hash_mask];
+    while (*link != b - s->blocks)
+        link = &s->blocks[*link].hash_next;
+    *link = b->hash_next;
+    b->hash_next = -1;
+}
+
+// Mark a block that is not in the hash table as unused.
+static void cache_reset_block(struct priv *s, struct cache_block *b)
+{
+    b->pos = -1;
+    b->len = 0;
+    // Unused blocks are recycled first.
+    int index = b - s->blocks;
+    if (s->lru_first != index) {
+        cache_lru_unlink(s, b);
+        b->lru_next = s->lru_first;
+        if (s->lru_first >= 0) {
+            s->blocks[s->lru_first].lru_prev = index;
+        } else {
+            s->lru_last = index;
+        }
+        s->lru_first = index;
+    }
+}
+
+static void cache_free_block(struct priv *s, struct cache_block *b)
+{
+    cache_hash_unlink(s, b);
+    cache_reset_block(s, b);
+}
+
+// Free a block whose contents are dropped without having been evicted.
+static void cache_discard_block(struct priv *s, struct cache_block *b)
+{
+    s->stats.discarded += b->len;
+    cache_free_block(s, b);
+}
+
+// Assign a block to the slot of pos, evicting the least recently used block
+// outside of the readahead window [win_start, win_end) if necessary.
+static struct cache_block *cache_alloc_block(struct priv *s, int64_t pos,
+                                             int64_t win_start, int64_t win_end)
+{
+    struct cache_block *b = NULL;
+    for (int i = s->lru_first; i >= 0; i = s->blocks[i].lru_next) {
+        struct cache_block *cur = &s->blocks[i];
+        if (cur->pins)
+            continue;
+        if (cur->pos < 0) {
+            b = cur;
+            break;
+        }
+        if (i == s->filling || i == s->fast_block)
+            continue;
+        int64_t slot = cache_slot(s, cur->pos);
+        if (slot >= cache_slot(s, win_start) && slot <= cache_slot(s, win_end))
+            continue;
+        b = cur;
+        break;
+    }
+    if (!b)
+        return NULL;
+    if (b->pos >= 0)
+        cache_free_block(s, b);
+    int *head = &s->hash[cache_slot(s, pos) & s->hash_mask];
+    b->pos = pos;
+    b->len = 0;
+    b->hash_next = *head;
+    *head = b - s->blocks;
+    cache_lru_touch(s, b);
+    return b;
+}
+
+// Number of bytes that can be read from pos on without waiting.
+static int64_t cache_contiguous_bytes(struct priv *s, int64_t pos)
+{
+    int64_t start = pos;
+    struct cache_block *b;
+    while ((b = cache_find_block(s, pos)))
+        pos = b->pos + b->len;
+    return pos - start;
+}
+
+// Return the first position in [pos, end) which still needs to be read from
+// the source, or -1 if all of it is cached.
+static int64_t cache_next_fill_pos(struct priv *s, int64_t pos, int64_t end)
+{
+    while (pos < end) {
+        struct cache_block *b = cache_find_slot(s, pos);
+        if (!b || pos < b->pos)
+            return pos;
+        int64_t b_end = b->pos + b->len;
+        if (b_end < (cache_slot(s, pos) + 1) * s->block_size)
+            return b_end; // partially filled block
+        pos = b_end;
+    }
+    return -1;
+}
+
 // Runs in the cache thread
 static void cache_drop_contents(struct priv *s)
 {
-    s->offset = s->min_filepos = s->max_filepos = s->read_filepos;
+    for (int n = 0; n < s->num_blocks; n++) {
+        struct cache_block *b = &s->blocks[n];
+        if (b->pos < 0)
+            continue;
+        if (n == s->fast_block) {
+            // The main thread might be reading from it right now. Leave the
+            // data alone, and make sure nobody else finds it.
+            if (!s->fast_block_stale) {
+                s->stats.discarded += b->len;
+                cache_hash_unlink(s, b);
+                s->fast_block_stale = true;
+            }
+            continue;
+        }
+        cache_discard_block(s, b);
+    }
+    s->fill_pos = s->read_filepos;
     s->eof = false;
 }
 
+// Runs in the main thread, with the mutex held.
+static void cache_drop_fast_block(struct priv *s)
+{
+    if (s->fast_block >= 0 && s->fast_block_stale)
+        cache_reset_block(s, &s->blocks[s->fast_block]);
+    s->fast_block = -1;
+    s->fast_block_stale = false;
+}
+
 // Runs in the main thread
 // mutex must be held, but is sometimes temporarily dropped
 static int cache_read(struct priv *s, unsigned char *buf, int size)
@@ -175,31 +429,45 @@ static int cache_read(struct priv *s, unsigned char *buf, int size)
 
     double retry = 0;
     int64_t eof_retry = s->reads - 1; // try at least 1 read on EOF
-    while (s->read_filepos >= s->max_filepos ||
-           s->read_filepos < s->min_filepos)
-    {
-        if (s->eof && s->read_filepos >= s->max_filepos && s->reads >= eof_retry)
+    struct cache_block *b;
+    while (!(b = cache_find_block(s, s->read_filepos))) {
+        if (s->eof && s->read_filepos >= s->fill_pos && s->reads >= eof_retry)
             return 0;
         if (cache_wakeup_and_wait(s, &retry) == CACHE_INTERRUPTED)
             return 0;
     }
 
-    int64_t newb = s->max_filepos - s->read_filepos; // new bytes in the buffer
-
-    int64_t pos = s->read_filepos - s->offset; // file pos to buffer memory pos
-    if (pos < 0)
-        pos += s->buffer_size;
-    else if (pos >= s->buffer_size)
-        pos -= s->buffer_size;
+    int64_t offset = s->read_filepos - b->pos;
+    int64_t newb = FFMIN(b->len - offset, size);
 
-    if (newb > s->buffer_size - pos)
-        newb = s->buffer_size - pos; // handle wrap...
-
-    newb = FFMIN(newb, size);
-
-    memcpy(buf, &s->buffer[pos], newb);
+    memcpy(buf, cache_block_ptr(s, b) + offset, newb);
+    cache_lru_touch(s, b);
 
     s->read_filepos += newb;
+    if (s->fast_block != b - s->blocks) {
+        cache_drop_fast_block(s);
+        s->fast_block = b - s->blocks;
+    }
+    return newb;
+}
+
+// Runs in the main thread, without holding the mutex.
+// Read from the current fast_block; return 0 if it has no data at pos.
+// *at_end is set if the read reached the end of the data in the block.
+static int cache_read_fast(struct priv *s, int64_t pos, unsigned char *buf,
+                           int size, bool *at_end)
+{
+    mp_memory_barrier();
+    if (s->fast_block < 0 || s->fast_block_stale)
+        return 0;
+    struct cache_block *b = &s->blocks[s->fast_block];
+    int len = b->len;
+    mp_memory_barrier();
+    if (pos < b->pos || pos >= b->pos + len)
+        return 0;
+    int newb = FFMIN(b->pos + len - pos, size);
+    memcpy(buf, cache_block_ptr(s, b) + (pos - b->pos), newb);
+    *at_end = pos + newb == b->pos + len;
     return newb;
 }
 
@@ -210,73 +478,120 @@ static bool cache_fill(struct priv *s)
     int64_t read = s->read_filepos;
     int len;
 
-    if (read < s->min_filepos || read > s->max_filepos) {
-        // seek...
-        MP_DBG(s, "Out of boundaries... seeking to %" PRId64 "  \n", read);
-        // drop cache contents only if seeking backward or too much fwd.
-        // This is also done for on-disk files, since it loses the backseek cache.
-        // That in turn can cause major bandwidth increase and performance
-        // issues with e.g. mov or badly interleaved files
-        if (read < s->min_filepos || read >= s->max_filepos + s->seek_limit) {
-            MP_VERBOSE(s, "Dropping cache at pos %"PRId64", "
-                   "cached range: %"PRId64"-%"PRId64".\n", read,
-                   s->min_filepos, s->max_filepos);
-            cache_drop_contents(s);
-            stream_seek(s->stream, read);
-        }
-    }
-
-    // number of buffer bytes which should be preserved in backwards direction
-    int64_t back = mp_clipi64(read - s->min_filepos, 0, s->back_size);
+    // The readahead window; everything behind it is kept as long as there is
+    // space, and is thrown away in LRU order.
+    int64_t win_end = read + (s->buffer_size - s->back_size);
 
-    // number of buffer bytes that are valid and can be read
-    int64_t newb = FFMAX(s->max_filepos - read, 0);
-
-    // max. number of bytes that can be written (starting from max_filepos)
-    int64_t space = s->buffer_size - (newb + back);
+    int64_t pos = cache_next_fill_pos(s, read, win_end);
+    if (pos < 0 || win_end - pos < s->fill_limit) {
+        s->idle = true;
+        s->reads++; // don't stuck main thread
+        return false;
+    }
 
-    // offset into the buffer that maps to max_filepos
-    int pos = s->max_filepos - s->offset;
-    if (pos >= s->buffer_size)
-        pos -= s->buffer_size; // wrap-around
+    // If the reader skipped a little ahead of the fill position, reading over
+    // the gap is cheaper than seeking (this is also done for on-disk files,
+    // since seeking can cause major bandwidth increase and performance issues
+    // with e.g. mov or badly interleaved files).
+    if (read > s->fill_pos && read - s->fill_pos < s->seek_limit) {
+        struct cache_block *b = cache_find_slot(s, s->fill_pos);
+        if (!b || b->pos + b->len == s->fill_pos)
+            pos = s->fill_pos;
+    }
 
-    if (space < s->fill_limit) {
+    struct cache_block *b = cache_find_slot(s, pos);
+    if (b && b->pos + b->len != pos) {
+        // Can't prepend data to a block; start it over.
+        if (b - s->blocks == s->fast_block) {
+            s->idle = true;
+            s->reads++;
+            return false;
+        }
+        cache_discard_block(s, b);
+        b = NULL;
+    }
+    if (!b)
+        b = cache_alloc_block(s, pos, read, win_end);
+    if (!b) {
+        MP_ERR(s, "No free cache block.\n");
         s->idle = true;
-        s->reads++; // don't stuck main thread
+        s->reads++;
         return false;
     }
 
-    // limit to end of buffer (without wrapping)
-    if (pos + space >= s->buffer_size)
-        space = s->buffer_size - pos;
+    // Data available from the persistent cache doesn't need the source. (The
+    // source position can differ from fill_pos after such reads.)
+    int64_t stored = s->store ? cache_store_avail(s->store, pos) : 0;
+    int64_t source_pos = stream_tell(s->stream);
+    if (!stored && pos != source_pos) {
+        MP_VERBOSE(s, "Seeking source to %"PRId64" (was at %"PRId64").\n",
+                   pos, source_pos);
+        s->stats.source_seeks++;
+        if (!stream_seek(s->stream, pos)) {
+            cache_free_block(s, b);
+            s->fill_pos = pos;
+            s->eof = true;
+            s->idle = true;
+            s->reads++;
+            pthread_cond_signal(&s->wakeup);
+            return false;
+        }
+    }
+    s->fill_pos = pos;
+
+    // limit to end of block
+    int64_t space = (cache_slot(s, pos) + 1) * s->block_size - pos;
 
     // limit read size (or else would block and read the entire buffer in 1 call)
     space = FFMIN(space, s->stream->read_chunk);
 
-    // back+newb+space <= buffer_size
-    int64_t back2 = s->buffer_size - (space + newb); // max back size
-    if (s->min_filepos < (read - back2))
-        s->min_filepos = read - back2;
+    unsigned char *dst = cache_block_ptr(s, b) + b->len;
 
     // The read call might take a long time and block, so drop the lock.
+    s->filling = b - s->blocks;
     pthread_mutex_unlock(&s->mutex);
-    len = stream_read_partial(s->stream, &s->buffer[pos], space);
+    double start = mp_time_sec();
+    if (stored) {
+        len = cache_store_read(s->store, pos, dst, FFMIN(space, stored));
+    } else {
+        len = stream_read_partial(s->stream, dst, space);
+        if (s->store)
+            cache_store_write(s->store, pos, dst, len);
+    }
+    double duration = mp_time_sec() - start;
     pthread_mutex_lock(&s->mutex);
+    s->filling = -1;
+
+    static const int latency_limits[] = STREAM_CACHE_LATENCY_LIMITS;
+    int bucket = 0;
+    while (bucket < MP_ARRAY_SIZE(latency_limits) &&
+           duration * 1000 >= latency_limits[bucket])
+        bucket++;
+    s->stats.read_latency[bucket]++;
+    s->stats.read_time += duration;
+    s->stats.bytes_read += FFMAX(len, 0);
 
     double pts;
-    if (stream_control(s->stream, STREAM_CTRL_GET_CURRENT_TIME, &pts) <= 0)
+    if (stored ||
+        stream_control(s->stream, STREAM_CTRL_GET_CURRENT_TIME, &pts) <= 0)
         pts = MP_NOPTS_VALUE;
-    for (int64_t b_pos = pos; b_pos < pos + len + BYTE_META_CHUNK_SIZE;
+    int64_t buf_pos = dst - s->buffer;
+    for (int64_t b_pos = buf_pos; b_pos < buf_pos + len + BYTE_META_CHUNK_SIZE;
          b_pos += BYTE_META_CHUNK_SIZE)
     {
         s->bm[b_pos / BYTE_META_CHUNK_SIZE] = (struct byte_meta){.stream_pts = pts};
     }
 
-    s->max_filepos += len;
-    if (pos + len == s->buffer_size)
-        s->offset += s->buffer_size; // wrap...
+    len = FFMAX(len, 0);
+    // Make sure the data is visible to cache_read_fast() before the length.
+    mp_memory_barrier();
+    b->len += len;
+    if (!b->len)
+        cache_free_block(s, b);
+    s->fill_pos += len;
 
-    s->eof = len <= 0;
+    // A failed persistent cache read is retried from the source.
+    s->eof = len <= 0 && !stored;
     s->idle = s->eof;
     s->reads++;
     if (s->eof)
@@ -312,6 +627,84 @@ static void update_cached_controls(struct priv *s)
     s->stream_size = s->stream->end_pos;
 }
 
+// Runs in the cache thread
+static void update_stats(struct priv *s)
+{
+    double now = mp_time_sec();
+    if (now - s->rate_time >= 1.0) {
+        s->stats.read_rate = (s->stats.bytes_read - s->rate_bytes) /
+                             (now - s->rate_time);
+        s->rate_bytes = s->stats.bytes_read;
+        s->rate_time = now;
+    }
+
+    if (now - s->log_time < CACHE_STATS_LOG_TIME)
+        return;
+    struct stream_cache_stats *st = &s->stats, *old = &s->logged;
+    if (st->bytes_read != old->bytes_read || st->waits != old->waits ||
+        st->seeks != old->seeks)
+    {
+        int64_t reads = 0;
+        for (int n = 0; n < STREAM_CACHE_LATENCY_BUCKETS; n++)
+            reads += st->read_latency[n] - old->read_latency[n];
+        double read_time = st->read_time - old->read_time;
+        MP_VERBOSE(s, "Read %"PRId64" KiB at %.0f KiB/s (%"PRId64" reads, "
+                   "avg. %.1f ms), blocked %"PRId64" times for %.3f s, "
+                   "%"PRId64" seeks (%"PRId64" cached, %"PRId64" on source), "
+                   "%"PRId64" KiB discarded.\n",
+                   (st->bytes_read - old->bytes_read) / 1024,
+                   read_time > 0 ? (st->bytes_read - old->bytes_read) /
+                                   read_time / 1024 : 0,
+                   reads, reads ? read_time / reads * 1000 : 0,
+                   st->waits - old->waits, st->wait_time - old->wait_time,
+                   st->seeks - old->seeks, st->seeks_cached - old->seeks_cached,
+                   st->source_seeks - old->source_seeks,
+                   (st->discarded - old->discarded) / 1024);
+    }
+    s->logged = *st;
+    s->log_time = now;
+}
+
+// Runs in the cache thread
+// Size the readahead window to hold target_secs of media, and scale the
+// read thresholds with the measured source speed.
+static void update_limits(struct priv *s)
+{
+    if (s->target_secs <= 0 || s->media_rate <= 0)
+        return;
+
+    // Average speed of the source while reading (not including idle time)
+    double speed = s->stats.read_time > 0 ?
+                   s->stats.bytes_read / s->stats.read_time : 0;
+
+    // A source that is barely faster than the media needs more buffer to
+    // absorb variations.
+    double secs = s->target_secs;
+    if (speed > 0 && speed < s->media_rate * 2)
+        secs *= FFMIN(s->media_rate * 2 / speed, 4);
+
+    // Always keep some of the buffer for backward seeking.
+    int64_t max_readahead = s->buffer_size - s->buffer_size / 4;
+    int64_t min_readahead = FFMIN(s->block_size * 2, max_readahead);
+    int64_t readahead = MPCLAMP(secs * s->media_rate, min_readahead,
+                                max_readahead);
+
+    int64_t old_readahead = s->buffer_size - s->back_size;
+    if (llabs(readahead - old_readahead) > old_readahead / 10) {
+        MP_VERBOSE(s, "Readahead set to %"PRId64" KiB (%.1f s at %.0f KiB/s, "
+                   "source %.0f KiB/s).\n", readahead / 1024, secs,
+                   s->media_rate / 1024, speed / 1024);
+        s->back_size = s->buffer_size - readahead;
+    }
+    readahead = s->buffer_size - s->back_size;
+
+    s->fill_limit = MPCLAMP(readahead / 16, 16 * 1024, s->block_size);
+    if (speed > 0) {
+        s->seek_limit = MPCLAMP(speed * CACHE_SEEK_COST, s->fill_limit,
+                                readahead - s->fill_limit);
+    }
+}
+
 // the core might call these every frame, so cache them...
 static int cache_get_cached_control(stream_t *cache, int cmd, void *arg)
 {
@@ -321,11 +714,17 @@ static int cache_get_cached_control(stream_t *cache, int cmd, void *arg)
         *(int64_t *)arg = s->buffer_size;
         return STREAM_OK;
     case STREAM_CTRL_GET_CACHE_FILL:
-        *(int64_t *)arg = s->max_filepos - s->read_filepos;
+        *(int64_t *)arg = cache_contiguous_bytes(s, s->read_filepos);
         return STREAM_OK;
     case STREAM_CTRL_GET_CACHE_IDLE:
         *(int *)arg = s->idle;
         return STREAM_OK;
+    case STREAM_CTRL_GET_CACHE_STATS:
+        *(struct stream_cache_stats *)arg = s->stats;
+        return STREAM_OK;
+    case STREAM_CTRL_SET_CACHE_BITRATE:
+        s->media_rate = *(double *)arg;
+        return STREAM_OK;
     case STREAM_CTRL_GET_TIME_LENGTH:
         *(double *)arg = s->stream_time_length;
         return s->stream_time_length ? STREAM_OK : STREAM_UNSUPPORTED;
@@ -342,16 +741,13 @@ static int cache_get_cached_control(stream_t *cache, int cmd, void *arg)
         *(unsigned int *)arg = s->stream_num_chapters;
         return STREAM_OK;
     case STREAM_CTRL_GET_CURRENT_TIME: {
-        if (s->read_filepos >= s->min_filepos &&
-            s->read_filepos <= s->max_filepos &&
-            s->min_filepos < s->max_filepos)
-        {
-            int64_t fpos = FFMIN(s->read_filepos, s->max_filepos - 1);
-            int64_t pos = fpos - s->offset;
-            if (pos < 0)
-                pos += s->buffer_size;
-            else if (pos >= s->buffer_size)
-                pos -= s->buffer_size;
+        // Only used by the stream's reader, so cache->pos is current.
+        int64_t fpos = cache->pos;
+        struct cache_block *b = cache_find_block(s, fpos);
+        if (!b && fpos > 0)
+            b = cache_find_block(s, --fpos);
+        if (b) {
+            int64_t pos = cache_block_ptr(s, b) + (fpos - b->pos) - s->buffer;
             double pts = s->bm[pos / BYTE_META_CHUNK_SIZE].stream_pts;
             *(double *)arg = pts;
             return pts == MP_NOPTS_VALUE ? STREAM_UNSUPPORTED : STREAM_OK;
@@ -423,11 +819,14 @@ static void *cache_thread(void *arg)
     pthread_mutex_lock(&s->mutex);
     update_cached_controls(s);
     double last = mp_time_sec();
+    s->rate_time = s->log_time = last;
     while (s->control != CACHE_CTRL_QUIT) {
         if (mp_time_sec() - last > CACHE_UPDATE_CONTROLS_TIME) {
             update_cached_controls(s);
             last = mp_time_sec();
         }
+        update_stats(s);
+        update_limits(s);
         if (s->control > 0) {
             cache_execute_control(s);
         } else {
@@ -451,18 +850,95 @@ static int cache_fill_buffer(struct stream *cache, char *buffer, int max_len)
     struct priv *s = cache->priv;
     assert(s->cache_thread_running);
 
-    pthread_mutex_lock(&s->mutex);
+    // Sequential reads within a block don't need to synchronize with the
+    // cache thread. This avoids lock contention with small reads. Once the
+    // end of the block's data is reached, let the cache thread know about the
+    // new read position, so that it keeps reading ahead.
+    bool at_end = false;
+    int t = cache_read_fast(s, cache->pos, buffer, max_len, &at_end);
+    if (t > 0) {
+        if (at_end) {
+            pthread_mutex_lock(&s->mutex);
+            s->read_filepos = cache->pos + t;
+            pthread_cond_signal(&s->wakeup);
+            pthread_mutex_unlock(&s->mutex);
+        }
+        return t;
+    }
 
-    if (cache->pos != s->read_filepos)
-        MP_ERR(s, "!!! read_filepos differs !!! report this bug...\n");
+    pthread_mutex_lock(&s->mutex);
 
-    int t = cache_read(s, buffer, max_len);
+    s->read_filepos = cache->pos;
+    if (s->fast_block_stale)
+        cache_drop_fast_block(s);
+    t = cache_read(s, buffer, max_len);
     // wakeup the cache thread, possibly make it read more data ahead
     pthread_cond_signal(&s->wakeup);
     pthread_mutex_unlock(&s->mutex);
     return t;
 }
 
+// Views can't span multiple blocks. (block_size is constant, so this doesn't
+// need the mutex.)
+static bool cache_can_borrow(struct stream *cache, int64_t pos, int len)
+{
+    struct priv *s = cache->priv;
+    return pos + len <= (cache_slot(s, pos) + 1) * s->block_size;
+}
+
+// Return a pointer to the len bytes at the read position, if they are (or
+// will be) in a single block. The block is not reused until the view is
+// released with cache_release_view().
+static void *cache_borrow(struct stream *cache, int len, void **handle)
+{
+    struct priv *s = cache->priv;
+    assert(s->cache_thread_running);
+
+    pthread_mutex_lock(&s->mutex);
+
+    s->read_filepos = cache->pos;
+
+    void *res = NULL;
+    int64_t pos = s->read_filepos;
+    if (!cache_can_borrow(cache, pos, len))
+        goto done;
+
+    double retry = 0;
+    int64_t eof_retry = s->reads - 1; // try at least 1 read on EOF
+    for (;;) {
+        struct cache_block *b = cache_find_block(s, pos);
+        if (b && pos + len <= b->pos + b->len) {
+            b->pins++;
+            cache_lru_touch(s, b);
+            *handle = b;
+            res = cache_block_ptr(s, b) + (pos - b->pos);
+            s->read_filepos += len;
+            break;
+        }
+        if (s->eof && pos + len > s->fill_pos && s->reads >= eof_retry)
+            break;
+        if (cache_wakeup_and_wait(s, &retry) == CACHE_INTERRUPTED)
+            break;
+    }
+    pthread_cond_signal(&s->wakeup);
+
+done:
+    pthread_mutex_unlock(&s->mutex);
+    return res;
+}
+
+static void cache_release_view(struct stream *cache, void *handle)
+{
+    struct priv *s = cache->priv;
+    struct cache_block *b = handle;
+
+    pthread_mutex_lock(&s->mutex);
+    assert(b->pins > 0);
+    b->pins--;
+    pthread_cond_signal(&s->wakeup);
+    pthread_mutex_unlock(&s->mutex);
+}
+
 static int cache_seek(stream_t *cache, int64_t pos)
 {
     struct priv *s = cache->priv;
@@ -470,11 +946,15 @@ static int cache_seek(stream_t *cache, int64_t pos)
 
     pthread_mutex_lock(&s->mutex);
 
-    MP_DBG(s, "request seek: %" PRId64 " <= to=%" PRId64
-           " (cur=%" PRId64 ") <= %" PRId64 "  \n",
-           s->min_filepos, pos, s->read_filepos, s->max_filepos);
+    bool cached = cache_find_block(s, pos);
+    MP_DBG(s, "request seek: to=%" PRId64 " (cur=%" PRId64 ", cached=%s)\n",
+           pos, s->read_filepos, cached ? "yes" : "no");
+
+    s->stats.seeks++;
+    s->stats.seeks_cached += cached;
 
     cache->pos = s->read_filepos = pos;
+    cache_drop_fast_block(s);
     s->eof = false; // so that cache_read() will actually wait for new data
     pthread_cond_signal(&s->wakeup);
     pthread_mutex_unlock(&s->mutex);
@@ -491,10 +971,14 @@ static int cache_control(stream_t *cache, int cmd, void *arg)
 
     pthread_mutex_lock(&s->mutex);
 
+    // Cached controls don't touch the read position: they're also used by the
+    // player for status display, while another thread reads the stream.
     r = cache_get_cached_control(cache, cmd, arg);
     if (r != STREAM_ERROR)
         goto done;
 
+    s->read_filepos = cache->pos;
+
     MP_VERBOSE(s, "[cache] blocking for STREAM_CTRL %d\n", cmd);
 
     s->control = cmd;
@@ -509,6 +993,7 @@ static int cache_control(stream_t *cache, int cmd, void *arg)
     }
     r = s->control_res;
     if (s->control_flush) {
+        cache_drop_fast_block(s);
         cache->pos = s->read_filepos;
         cache->eof = 0;
         cache->buf_pos = cache->buf_len = 0;
@@ -519,6 +1004,69 @@ done:
     return r;
 }
 
+// Map the buffer and the byte_meta array from a file, instead of allocating
+// them in RAM. This allows caches larger than the available memory; the OS
+// page cache keeps the recently used parts in memory.
+// path is either a filename, or "TMP" for an anonymous temporary file.
+static bool cache_map_file(struct priv *s, const char *path, size_t bm_size)
+{
+#if HAVE_SYS_MMAN_H
+    char *name;
+    int fd;
+    if (strcmp(path, "TMP") == 0) {
+        const char *dir = getenv("TMPDIR");
+        name = talloc_asprintf(s, "%s/mpv-cache-XXXXXX",
+                               dir && dir[0] ? dir : "/tmp");
+        fd = mkstemp(name);
+        if (fd >= 0)
+            unlink(name);
+    } else {
+        name = talloc_strdup(s, path);
+        fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    if (fd < 0) {
+        MP_ERR(s, "Could not create cache file '%s': %s\n", name,
+               strerror(errno));
+        return false;
+    }
+
+    size_t size = s->buffer_size + bm_size;
+    void *ptr = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        MP_ERR(s, "Could not map cache file '%s': %s\n", name, strerror(err));
+        return false;
+    }
+
+    s->buffer = ptr;
+    s->bm = (struct byte_meta *)(s->buffer + s->buffer_size);
+    s->mapped_size = size;
+    MP_VERBOSE(s, "Using cache file '%s'.\n", name);
+    return true;
+#else
+    MP_ERR(s, "Cache files are not supported on this system.\n");
+    return false;
+#endif
+}
+
+static void cache_free_buffers(struct priv *s)
+{
+    if (s->mapped_size) {
+#if HAVE_SYS_MMAN_H
+        munmap(s->buffer, s->mapped_size);
+#endif
+    } else {
+        free(s->buffer);
+        free(s->bm);
+    }
+    s->buffer = NULL;
+    s->bm = NULL;
+    s->mapped_size = 0;
+}
+
 static void cache_uninit(stream_t *cache)
 {
     struct priv *s = cache->priv;
@@ -530,10 +1078,10 @@ static void cache_uninit(stream_t *cache)
         pthread_mutex_unlock(&s->mutex);
         pthread_join(s->cache_thread, NULL);
     }
+    cache_store_close(s->store);
     pthread_mutex_destroy(&s->mutex);
     pthread_cond_destroy(&s->wakeup);
-    free(s->buffer);
-    free(s->bm);
+    cache_free_buffers(s);
     talloc_free(s);
 }
 
@@ -556,22 +1104,63 @@ int stream_cache_init(stream_t *cache, stream_t *stream, int64_t size,
     struct priv *s = talloc_zero(NULL, struct priv);
     s->log = cache->log;
 
+    // Use bigger blocks for bigger caches, but keep enough of them around to
+    // cache multiple disjoint ranges.
+    s->block_size = CACHE_MIN_BLOCK_SIZE;
+    while (s->block_size < CACHE_MAX_BLOCK_SIZE &&
+           size / (s->block_size * 2) >= CACHE_BLOCKS_TARGET)
+        s->block_size *= 2;
+
     //64kb min_size
     s->fill_limit = FFMAX(16 * 1024, BYTE_META_CHUNK_SIZE * 2);
     s->buffer_size = FFMAX(size, s->fill_limit * 4);
+    s->num_blocks = FFMAX(s->buffer_size / s->block_size, CACHE_MIN_BLOCKS);
+    s->buffer_size = s->num_blocks * s->block_size;
     s->back_size = s->buffer_size / 2;
 
-    s->buffer = malloc(s->buffer_size);
-    s->bm = malloc((s->buffer_size / BYTE_META_CHUNK_SIZE + 2) *
-                   sizeof(struct byte_meta));
+    size_t bm_size = (s->buffer_size / BYTE_META_CHUNK_SIZE + 2) *
+                     sizeof(struct byte_meta);
+    char *file = cache->opts ? cache->opts->stream_cache_file : NULL;
+    if (file && file[0]) {
+        if (!cache_map_file(s, file, bm_size)) {
+            talloc_free(s);
+            return -1;
+        }
+    } else {
+        s->buffer = malloc(s->buffer_size);
+        s->bm = malloc(bm_size);
+    }
     if (!s->buffer || !s->bm) {
         MP_ERR(s, "Failed to allocate cache buffer.\n");
-        free(s->buffer);
-        free(s->bm);
+        cache_free_buffers(s);
         talloc_free(s);
         return -1;
     }
 
+    int hash_size = 1;
+    while (hash_size < s->num_blocks)
+        hash_size *= 2;
+    s->hash_mask = hash_size - 1;
+    s->hash = talloc_array(s, int, hash_size);
+    for (int n = 0; n < hash_size; n++)
+        s->hash[n] = -1;
+    s->blocks = talloc_array(s, struct cache_block, s->num_blocks);
+    for (int n = 0; n < s->num_blocks; n++) {
+        s->blocks[n] = (struct cache_block){
+            .pos = -1,
+            .hash_next = -1,
+            .lru_prev = n - 1,
+            .lru_next = n + 1 < s->num_blocks ? n + 1 : -1,
+        };
+    }
+    s->lru_first = 0;
+    s->lru_last = s->num_blocks - 1;
+    s->filling = -1;
+    s->fast_block = -1;
+
+    MP_VERBOSE(s, "Using %d blocks of %"PRId64" KiB.\n", s->num_blocks,
+               s->block_size / 1024);
+
     pthread_mutex_init(&s->mutex, NULL);
     pthread_cond_init(&s->wakeup, NULL);
 
@@ -581,16 +1170,23 @@ int stream_cache_init(stream_t *cache, stream_t *stream, int64_t size,
 
     cache->seek = cache_seek;
     cache->fill_buffer = cache_fill_buffer;
+    cache->borrow = cache_borrow;
+    cache->release_view = cache_release_view;
+    cache->can_borrow = cache_can_borrow;
     cache->control = cache_control;
     cache->close = cache_uninit;
 
     s->seek_limit = seek_limit;
+    s->target_secs = cache->opts ? cache->opts->stream_cache_secs : 0;
     //make sure that we won't wait from cache_fill
     //more data than it is allowed to fill
-    if (s->seek_limit > s->buffer_size - s->fill_limit)
-        s->seek_limit = s->buffer_size - s->fill_limit;
-    if (min > s->buffer_size - s->fill_limit)
-        min = s->buffer_size - s->fill_limit;
+    int64_t readahead = s->buffer_size - s->back_size;
+    if (s->seek_limit > readahead - s->fill_limit)
+        s->seek_limit = readahead - s->fill_limit;
+    if (min > readahead - s->fill_limit)
+        min = readahead - s->fill_limit;
+
+    s->store = cache_store_open(s, s->log, stream);
 
     if (pthread_create(&s->cache_thread, NULL, cache_thread, s) != 0) {
         MP_ERR(s, "Starting cache process/thread failed: %s.\n",
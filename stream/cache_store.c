@@ -0,0 +1,384 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Persistent cache: the data read by the stream cache is also written to a
+// file in the cache directory, named after a hash of the URL, the stream size,
+// and the contents of the first and last bytes of the stream. The byte ranges
+// available in the file are listed in an index file next to it. When the same
+// stream is played again, the cache reads these ranges from the file instead
+// of the source.
+//
+// The total size of the directory is limited; the least recently used entries
+// (by modification time of the index file) are deleted when opening a new one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+
+#include "osdep/io.h"
+
+#include "talloc.h"
+#include "common/common.h"
+#include "common/msg.h"
+#include "options/options.h"
+#include "options/path.h"
+#include "stream.h"
+#include "cache_store.h"
+
+#define STORE_SUBDIR "cache"
+
+// Number of bytes at the start and end of the stream included in the key.
+#define KEY_DATA_SIZE (64 * 1024)
+
+// Rewrite the index after this many new bytes (in case we crash).
+#define INDEX_UPDATE_BYTES (16 * 1024 * 1024)
+
+struct store_range {
+    int64_t start, end;
+};
+
+struct cache_store {
+    struct mp_log *log;
+    char *data_file;
+    char *index_file;
+    char *url;
+    int64_t size;           // stream size
+    int fd;
+
+    // Sorted, non-overlapping, non-adjacent.
+    struct store_range *ranges;
+    int num_ranges;
+    int64_t used;           // sum of all range sizes
+    int64_t limit;          // max. used
+    int64_t unsaved;        // bytes written since the last index update
+};
+
+struct store_entry {
+    char *name;             // filename without extension
+    time_t mtime;
+    int64_t size;
+};
+
+static char *get_key(void *ta_ctx, struct stream *stream)
+{
+    char *key = NULL;
+    int64_t pos = stream_tell(stream);
+    int64_t size = stream->end_pos;
+    char *buf = talloc_size(NULL, KEY_DATA_SIZE);
+    struct AVMD5 *md5 = av_md5_alloc();
+    if (!md5)
+        goto done;
+    av_md5_init(md5);
+    av_md5_update(md5, stream->url, strlen(stream->url) + 1);
+    char *size_s = talloc_asprintf(buf, "%"PRId64, size);
+    av_md5_update(md5, size_s, strlen(size_s) + 1);
+    int64_t offsets[2] = {0, MPMAX(size - KEY_DATA_SIZE, 0)};
+    for (int n = 0; n < 2; n++) {
+        int len = MPMIN(size - offsets[n], KEY_DATA_SIZE);
+        if (!stream_seek(stream, offsets[n]) ||
+            stream_read(stream, buf, len) != len)
+            goto done;
+        av_md5_update(md5, buf, len);
+    }
+    uint8_t hash[16];
+    av_md5_final(md5, hash);
+    key = talloc_strdup(ta_ctx, "");
+    for (int n = 0; n < 16; n++)
+        key = talloc_asprintf_append(key, "%02X", hash[n]);
+done:
+    if (!stream_seek(stream, pos)) {
+        talloc_free(key);
+        key = NULL;
+    }
+    av_free(md5);
+    talloc_free(buf);
+    return key;
+}
+
+static void add_range(struct cache_store *st, int64_t start, int64_t end)
+{
+    if (start >= end)
+        return;
+    // Merge with all ranges overlapping or adjacent to [start, end).
+    int first = 0;
+    while (first < st->num_ranges && st->ranges[first].end < start)
+        first++;
+    int last = first;
+    while (last < st->num_ranges && st->ranges[last].start <= end) {
+        start = MPMIN(start, st->ranges[last].start);
+        end = MPMAX(end, st->ranges[last].end);
+        st->used -= st->ranges[last].end - st->ranges[last].start;
+        last++;
+    }
+    struct store_range r = {start, end};
+    if (first == last) {
+        MP_TARRAY_APPEND(st, st->ranges, st->num_ranges, r);
+        memmove(&st->ranges[first + 1], &st->ranges[first],
+                (st->num_ranges - 1 - first) * sizeof(r));
+        st->ranges[first] = r;
+    } else {
+        st->ranges[first] = r;
+        for (int n = first + 1; n < last; n++)
+            MP_TARRAY_REMOVE_AT(st->ranges, st->num_ranges, first + 1);
+    }
+    st->used += end - start;
+}
+
+static void clear_ranges(struct cache_store *st)
+{
+    st->num_ranges = 0;
+    st->used = 0;
+}
+
+static void load_index(struct cache_store *st)
+{
+    FILE *f = fopen(st->index_file, "r");
+    if (!f)
+        return;
+    char line[4096];
+    int64_t size = -1;
+    while (fgets(line, sizeof(line), f)) {
+        int64_t a, b;
+        if (sscanf(line, "size %"SCNd64, &a) == 1) {
+            size = a;
+        } else if (sscanf(line, "%"SCNd64" %"SCNd64, &a, &b) == 2) {
+            if (a >= 0 && b <= st->size)
+                add_range(st, a, b);
+        }
+    }
+    fclose(f);
+
+    struct stat s;
+    int64_t max_end = st->num_ranges ? st->ranges[st->num_ranges - 1].end : 0;
+    if (size != st->size || fstat(st->fd, &s) || s.st_size < max_end) {
+        MP_WARN(st, "Ignoring invalid cache index '%s'.\n", st->index_file);
+        clear_ranges(st);
+    }
+}
+
+static void save_index(struct cache_store *st)
+{
+    FILE *f = fopen(st->index_file, "w");
+    if (!f) {
+        MP_ERR(st, "Can't write cache index '%s'.\n", st->index_file);
+        return;
+    }
+    fprintf(f, "# mpv persistent cache index\n");
+    fprintf(f, "# url %s\n", st->url);
+    fprintf(f, "size %"PRId64"\n", st->size);
+    for (int n = 0; n < st->num_ranges; n++)
+        fprintf(f, "%"PRId64" %"PRId64"\n", st->ranges[n].start,
+                st->ranges[n].end);
+    fclose(f);
+    st->unsaved = 0;
+}
+
+static int compare_mtime(const void *pa, const void *pb)
+{
+    const struct store_entry *a = pa, *b = pb;
+    return a->mtime < b->mtime ? -1 : (a->mtime > b->mtime ? 1 : 0);
+}
+
+// Delete least recently used entries (except the entry for key), until the
+// other entries use at most max_size bytes. Returns the size they use.
+static int64_t evict_entries(struct cache_store *st, const char *dir,
+                             const char *key, int64_t max_size)
+{
+    void *tmp = talloc_new(NULL);
+    struct store_entry *entries = NULL;
+    int num_entries = 0;
+    int64_t total = 0;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        goto done;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        bstr ext, name = bstr0(de->d_name);
+        if (!bstr_split_tok(name, ".", &name, &ext) || bstrcmp0(ext, "idx") ||
+            !bstrcmp0(name, key))
+            continue;
+        struct store_entry e = { .name = bstrdup0(tmp, name) };
+        char *path = mp_path_join(tmp, bstr0(dir), bstr0(de->d_name));
+        struct stat s;
+        if (stat(path, &s))
+            continue;
+        e.mtime = s.st_mtime;
+        path = talloc_asprintf(tmp, "%s/%s.data", dir, e.name);
+        if (stat(path, &s) == 0) {
+#ifdef __MINGW32__
+            e.size = s.st_size;
+#else
+            e.size = (int64_t)s.st_blocks * 512; // files are sparse
+#endif
+        }
+        total += e.size;
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+    }
+    closedir(d);
+
+    if (num_entries)
+        qsort(entries, num_entries, sizeof(entries[0]), compare_mtime);
+    for (int n = 0; n < num_entries && total > max_size; n++) {
+        struct store_entry *e = &entries[n];
+        MP_VERBOSE(st, "Removing cache entry %s.\n", e->name);
+        unlink(talloc_asprintf(tmp, "%s/%s.idx", dir, e->name));
+        unlink(talloc_asprintf(tmp, "%s/%s.data", dir, e->name));
+        total -= e->size;
+    }
+
+done:
+    talloc_free(tmp);
+    return total;
+}
+
+static void destroy(void *p)
+{
+    struct cache_store *st = p;
+    if (st->fd >= 0)
+        close(st->fd);
+}
+
+// Return NULL if the persistent cache is disabled, or the stream can't be
+// cached. The stream is read to compute the key, and then seeked back.
+struct cache_store *cache_store_open(void *talloc_ctx, struct mp_log *log,
+                                     struct stream *stream)
+{
+    struct MPOpts *opts = stream->opts;
+    if (!opts || opts->stream_cache_persist <= 0 || !stream->global)
+        return NULL;
+    if ((stream->flags & MP_STREAM_SEEK) != MP_STREAM_SEEK ||
+        stream->end_pos <= 0)
+    {
+        mp_verbose(log, "Stream not seekable, not using persistent cache.\n");
+        return NULL;
+    }
+
+    void *tmp = talloc_new(NULL);
+    struct cache_store *st = NULL;
+
+    char *dir = opts->stream_cache_persist_dir;
+    if (dir && dir[0]) {
+        dir = mp_get_user_path(tmp, stream->global, dir);
+        mkdir(dir, 0700);
+    } else {
+        mp_mk_config_dir(stream->global, STORE_SUBDIR);
+        dir = mp_find_user_config_file(tmp, stream->global, STORE_SUBDIR);
+    }
+    if (!dir || !mp_path_isdir(dir)) {
+        mp_err(log, "Persistent cache directory not available.\n");
+        goto done;
+    }
+
+    char *key = get_key(tmp, stream);
+    if (!key) {
+        mp_err(log, "Could not read stream for persistent cache.\n");
+        goto done;
+    }
+
+    st = talloc_zero(talloc_ctx, struct cache_store);
+    talloc_set_destructor(st, destroy);
+    st->log = log;
+    st->url = talloc_strdup(st, stream->url);
+    st->size = stream->end_pos;
+    st->data_file = talloc_asprintf(st, "%s/%s.data", dir, key);
+    st->index_file = talloc_asprintf(st, "%s/%s.idx", dir, key);
+    st->fd = open(st->data_file, O_RDWR | O_CREAT | O_CLOEXEC | O_BINARY, 0600);
+    if (st->fd < 0) {
+        mp_err(log, "Can't open '%s': %s\n", st->data_file, strerror(errno));
+        talloc_free(st);
+        st = NULL;
+        goto done;
+    }
+    load_index(st);
+
+    // Make room for the entire stream, if possible.
+    int64_t max_size = opts->stream_cache_persist * 1024LL;
+    int64_t others = evict_entries(st, dir, key, max_size - MPMIN(st->size,
+                                                                  max_size));
+    st->limit = MPMAX(max_size - others, 0);
+
+    MP_VERBOSE(st, "Using persistent cache entry %s (%"PRId64" of %"PRId64
+               " bytes cached).\n", key, st->used, st->size);
+
+done:
+    talloc_free(tmp);
+    return st;
+}
+
+void cache_store_close(struct cache_store *st)
+{
+    if (!st)
+        return;
+    save_index(st);
+    talloc_free(st);
+}
+
+// Number of bytes available from pos on.
+int64_t cache_store_avail(struct cache_store *st, int64_t pos)
+{
+    for (int n = 0; n < st->num_ranges; n++) {
+        struct store_range *r = &st->ranges[n];
+        if (pos < r->start)
+            break;
+        if (pos < r->end)
+            return r->end - pos;
+    }
+    return 0;
+}
+
+// Returns the number of bytes read. On errors, all data is considered lost,
+// and -1 is returned.
+int cache_store_read(struct cache_store *st, int64_t pos, void *buf, int len)
+{
+    len = MPMIN(len, cache_store_avail(st, pos));
+    int res = -1;
+    if (lseek(st->fd, pos, SEEK_SET) == pos)
+        res = read(st->fd, buf, len);
+    if (res <= 0 && len > 0) {
+        MP_ERR(st, "Error reading from cache file, dropping it.\n");
+        clear_ranges(st);
+        save_index(st);
+        return -1;
+    }
+    return res;
+}
+
+void cache_store_write(struct cache_store *st, int64_t pos, void *buf, int len)
+{
+    if (len <= 0 || st->used + len > st->limit)
+        return;
+    if (lseek(st->fd, pos, SEEK_SET) != pos || write(st->fd, buf, len) != len) {
+        MP_ERR(st, "Error writing to cache file: %s\n", strerror(errno));
+        return;
+    }
+    add_range(st, pos, pos + len);
+    st->unsaved += len;
+    if (st->unsaved >= INDEX_UPDATE_BYTES)
+        save_index(st);
+}
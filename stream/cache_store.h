@@ -0,0 +1,38 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_CACHE_STORE_H
+#define MPLAYER_CACHE_STORE_H
+
+#include <stdint.h>
+
+struct stream;
+struct mp_log;
+
+// Persistent on-disk copy of the data read from a stream (--cache-persistent).
+// All functions must be called from the same thread.
+struct cache_store;
+
+struct cache_store *cache_store_open(void *talloc_ctx, struct mp_log *log,
+                                     struct stream *stream);
+void cache_store_close(struct cache_store *st);
+
+int64_t cache_store_avail(struct cache_store *st, int64_t pos);
+int cache_store_read(struct cache_store *st, int64_t pos, void *buf, int len);
+void cache_store_write(struct cache_store *st, int64_t pos, void *buf, int len);
+
+#endif /* MPLAYER_CACHE_STORE_H */
@@ -51,6 +51,9 @@
 // Includes additional padding in case sizes get rounded up by sector size.
 #define TOTAL_BUFFER_SIZE (STREAM_MAX_BUFFER_SIZE + STREAM_MAX_SECTOR_SIZE)
 
+// Smaller reads are always copied by stream_read_view().
+#define STREAM_VIEW_MIN_SIZE (4 * STREAM_BUFFER_SIZE)
+
 /// We keep these 2 for the gui atm, but they will be removed.
 char *cdrom_device = NULL;
 char *dvd_device = NULL;
@@ -578,6 +581,74 @@ struct bstr stream_peek(stream_t *s, int len)
                   .len = FFMIN(len, s->buf_len - s->buf_pos)};
 }
 
+// Try to borrow len bytes from the stream's memory. Returns 1 on success,
+// 0 if the stream can't lend the data, and -1 on seek errors.
+static int borrow_view(stream_t *s, int len, struct stream_view *view)
+{
+    assert(len >= 0);
+    *view = (struct stream_view){.stream = s};
+    if (!s->borrow || len < STREAM_VIEW_MIN_SIZE)
+        return 0;
+    int64_t pos = stream_tell(s);
+    if (s->can_borrow && !s->can_borrow(s, pos, len))
+        return 0;
+    // Give buffered data back to the stream, so that all data can come
+    // from a single borrowed buffer. Seeking back is cheap with streams
+    // that support borrowing.
+    if (s->buf_pos < s->buf_len && (s->flags & MP_STREAM_SEEK_BW) &&
+        !s->capture_file)
+    {
+        stream_drop_buffers(s);
+        if (stream_seek_unbuffered(s, pos) >= 0)
+            return -1;
+    }
+    if (s->buf_pos < s->buf_len)
+        return 0;
+    void *handle = NULL;
+    unsigned char *data = s->borrow(s, len, &handle);
+    if (!data)
+        return 0;
+    s->pos += len;
+    s->eof = 0;
+    stream_capture_write(s, data, len);
+    view->data = data;
+    view->len = len;
+    view->handle = handle;
+    return 1;
+}
+
+// Read len bytes, and return a read-only view on them. If the stream supports
+// it (cache, local files), the view points directly into the stream's memory,
+// and no data is copied. Otherwise the data is read into a new buffer.
+// view->len is smaller than len on EOF or errors.
+// Unlike stream_peek(), the view stays valid across other stream calls, until
+// stream_release_view() is called. This must happen before closing the stream.
+void stream_read_view(stream_t *s, int len, struct stream_view *view)
+{
+    int r = borrow_view(s, len, view);
+    if (r != 0)
+        return; // borrowed, or seek error (return an empty view)
+    view->alloc = talloc_size(NULL, len);
+    view->data = view->alloc;
+    view->len = stream_read(s, view->alloc, len);
+}
+
+// Like stream_read_view(), but never copies the data. If the stream can't
+// lend its memory for the len bytes at the current position, return false
+// without reading anything.
+bool stream_borrow_view(stream_t *s, int len, struct stream_view *view)
+{
+    return borrow_view(s, len, view) > 0;
+}
+
+void stream_release_view(struct stream_view *view)
+{
+    if (view->handle)
+        view->stream->release_view(view->stream, view->handle);
+    talloc_free(view->alloc);
+    *view = (struct stream_view){0};
+}
+
 int stream_write_buffer(stream_t *s, unsigned char *buf, int len)
 {
     int rd;
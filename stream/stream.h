@@ -86,6 +86,8 @@ enum stream_ctrl {
     STREAM_CTRL_GET_CACHE_SIZE,
     STREAM_CTRL_GET_CACHE_FILL,
     STREAM_CTRL_GET_CACHE_IDLE,
+    STREAM_CTRL_GET_CACHE_STATS,        // struct stream_cache_stats*
+    STREAM_CTRL_SET_CACHE_BITRATE,      // double* (media bytes/second)
     STREAM_CTRL_RESUME_CACHE,
     STREAM_CTRL_RECONNECT,
     // DVD/Bluray, signal general support for GET_CURRENT_TIME etc.
@@ -106,6 +108,24 @@ struct stream_lang_req {
     char name[50];
 };
 
+// Upper limits (exclusive) of the read latency histogram buckets, in ms. The
+// last bucket contains everything above.
+#define STREAM_CACHE_LATENCY_LIMITS {1, 4, 16, 64, 256, 1000}
+#define STREAM_CACHE_LATENCY_BUCKETS 7
+
+struct stream_cache_stats {
+    int64_t bytes_read;     // bytes read from the source stream
+    double read_time;       // time spent in source stream reads (seconds)
+    double read_rate;       // recent source throughput (bytes/second)
+    int64_t read_latency[STREAM_CACHE_LATENCY_BUCKETS]; // number of reads
+    int64_t waits;          // number of times the reader blocked on the cache
+    double wait_time;       // total time the reader was blocked (seconds)
+    int64_t seeks;          // seeks requested by the reader
+    int64_t seeks_cached;   // ...of which the target was already cached
+    int64_t source_seeks;   // seeks performed on the source stream
+    int64_t discarded;      // cached bytes dropped due to seeks/flushes
+};
+
 struct stream_dvd_info_req {
     unsigned int palette[16];
     int num_subs;
@@ -139,6 +159,16 @@ typedef struct stream {
     int (*control)(struct stream *s, int cmd, void *arg);
     // Close
     void (*close)(struct stream *s);
+    // Borrow (optional): return a pointer to len bytes of data at the current
+    // position, or NULL if that's not possible. The data must stay valid
+    // until release_view() is called with the value written to *handle.
+    // The caller advances the stream position.
+    void *(*borrow)(struct stream *s, int len, void **handle);
+    void (*release_view)(struct stream *s, void *handle);
+    // Optional: return whether borrow() can succeed for len bytes at pos,
+    // without changing any state. Used to avoid dropping the stream buffer
+    // (and seeking back) when borrowing would fail anyway.
+    bool (*can_borrow)(struct stream *s, int64_t pos, int len);
 
     enum streamtype type; // see STREAMTYPE_*
     enum streamtype uncached_type; // if stream is cache, type of wrapped str.
@@ -231,6 +261,20 @@ inline static int64_t stream_tell(stream_t *s)
     return s->pos + s->buf_pos - s->buf_len;
 }
 
+// Read-only view on stream data, see stream_read_view().
+struct stream_view {
+    unsigned char *data;
+    int len;
+    // private
+    struct stream *stream;
+    void *handle;   // returned by stream->borrow
+    void *alloc;    // set if the data had to be copied
+};
+
+void stream_read_view(stream_t *s, int len, struct stream_view *view);
+bool stream_borrow_view(stream_t *s, int len, struct stream_view *view);
+void stream_release_view(struct stream_view *view);
+
 int stream_skip(stream_t *s, int64_t len);
 int stream_seek(stream_t *s, int64_t pos);
 int stream_read(stream_t *s, char *mem, int total);
@@ -26,22 +26,269 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "osdep/io.h"
 
+#include "talloc.h"
+#include "common/common.h"
 #include "common/msg.h"
 #include "stream.h"
 #include "options/m_option.h"
+#include "options/options.h"
+
+struct readahead;
 
 struct priv {
     int fd;
     bool close;
+    bool regular;   // fd refers to a regular file (can be mapped)
+    struct readahead *ra;
+};
+
+// Mapping the file is only worth it for large reads.
+#define MIN_VIEW_SIZE (256 * 1024)
+
+struct file_view {
+    void *map;
+    size_t map_size;
+};
+
+// Asynchronous readahead (--file-readahead). A thread reads fixed size,
+// aligned chunks ahead of the read position into a ring of chunk buffers,
+// so that reads can be served from memory, and the disk (or network file
+// system) is kept busy with large sequential requests.
+
+#define RA_ALIGN 4096
+
+struct ra_chunk {
+    int64_t pos;        // file position of the chunk data
+    int len;            // valid bytes (< chunk_size means EOF or error)
+    bool ready;         // read has finished
 };
 
+struct readahead {
+    struct mp_log *log;
+    int fd;
+    bool own_fd;        // fd was opened for the readahead (O_DIRECT)
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    // Constant while the thread is running
+    unsigned char *buffer;  // num_chunks * chunk_size bytes, aligned
+    int chunk_size;
+    int num_chunks;
+
+    // Protected by lock
+    struct ra_chunk *chunks;
+    int head;           // chunk containing the read position
+    int count;          // chunks starting from head in use (incl. in flight)
+    int64_t next_pos;   // file position the thread reads next
+    int generation;     // incremented on reset, invalidates reads in flight
+    bool eof;           // thread stopped at EOF
+    bool quit;
+};
+
+static void *ra_thread(void *arg)
+{
+    struct readahead *ra = arg;
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->quit) {
+        if (ra->eof || ra->count == ra->num_chunks) {
+            pthread_cond_wait(&ra->wakeup, &ra->lock);
+            continue;
+        }
+        int index = (ra->head + ra->count) % ra->num_chunks;
+        struct ra_chunk *c = &ra->chunks[index];
+        *c = (struct ra_chunk){ .pos = ra->next_pos };
+        ra->count++;
+        int generation = ra->generation;
+        unsigned char *dst = ra->buffer + (size_t)index * ra->chunk_size;
+
+        pthread_mutex_unlock(&ra->lock);
+        int len = 0;
+        bool eof = false;
+        while (len < ra->chunk_size) {
+            ssize_t r = pread(ra->fd, dst + len, ra->chunk_size - len,
+                              c->pos + len);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                MP_ERR(ra, "Read error: %s\n", strerror(errno));
+            if (r <= 0) {
+                eof = true;
+                break;
+            }
+            len += r;
+            // O_DIRECT can't read a partial last block without EOF
+            if (ra->own_fd && len % RA_ALIGN) {
+                eof = true;
+                break;
+            }
+        }
+#ifdef POSIX_FADV_WILLNEED
+        // Let the kernel prefetch the chunk we will read after the next.
+        posix_fadvise(ra->fd, c->pos + (int64_t)ra->chunk_size * ra->num_chunks,
+                      ra->chunk_size, POSIX_FADV_WILLNEED);
+#endif
+        pthread_mutex_lock(&ra->lock);
+
+        if (generation != ra->generation)
+            continue;
+        c->len = len;
+        c->ready = true;
+        ra->next_pos += ra->chunk_size;
+        ra->eof = eof;
+        pthread_cond_broadcast(&ra->wakeup);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+// Restart reading at pos. lock must be held.
+static void ra_reset(struct readahead *ra, int64_t pos)
+{
+    ra->generation++;
+    ra->head = 0;
+    ra->count = 0;
+    ra->next_pos = pos - pos % RA_ALIGN;
+    ra->eof = false;
+    pthread_cond_broadcast(&ra->wakeup);
+}
+
+static void ra_seek(struct readahead *ra, int64_t pos)
+{
+    pthread_mutex_lock(&ra->lock);
+    // Keep the buffered data if pos is in it (or a bit ahead of it).
+    int64_t start = ra->count ? ra->chunks[ra->head].pos : -1;
+    if (pos < start || pos >= ra->next_pos + ra->chunk_size || ra->eof)
+        ra_reset(ra, pos);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+static int ra_read(struct readahead *ra, int64_t pos, char *buffer,
+                   int max_len)
+{
+    int res = 0;
+    pthread_mutex_lock(&ra->lock);
+    for (;;) {
+        struct ra_chunk *c = &ra->chunks[ra->head];
+        if (!ra->count) {
+            if (ra->eof || pos < ra->next_pos ||
+                pos >= ra->next_pos + ra->chunk_size)
+                ra_reset(ra, pos);
+            pthread_cond_wait(&ra->wakeup, &ra->lock);
+        } else if (!c->ready) {
+            pthread_cond_wait(&ra->wakeup, &ra->lock);
+        } else if (pos >= c->pos && pos < c->pos + c->len) {
+            res = MPMIN(c->pos + c->len - pos, max_len);
+            memcpy(buffer, ra->buffer + (size_t)ra->head * ra->chunk_size +
+                   (pos - c->pos), res);
+            break;
+        } else if (pos >= c->pos + ra->chunk_size) {
+            // Chunk was consumed; give it back to the thread.
+            ra->head = (ra->head + 1) % ra->num_chunks;
+            ra->count--;
+            pthread_cond_broadcast(&ra->wakeup);
+        } else if (pos >= c->pos + c->len) {
+            // EOF or read error. Start over, so that the next read call
+            // retries (the file might be growing).
+            ra_reset(ra, pos);
+            break;
+        } else {
+            ra_reset(ra, pos);
+        }
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return res;
+}
+
+static void ra_destroy(struct readahead *ra)
+{
+    pthread_mutex_lock(&ra->lock);
+    ra->quit = true;
+    pthread_cond_broadcast(&ra->wakeup);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->wakeup);
+    if (ra->own_fd)
+        close(ra->fd);
+    free(ra->buffer);
+    talloc_free(ra);
+}
+
+// size: total readahead size in bytes
+static struct readahead *ra_create(stream_t *s, const char *filename,
+                                   int fd, int64_t size, bool direct)
+{
+    struct readahead *ra = talloc_zero(NULL, struct readahead);
+    ra->log = s->log;
+    ra->fd = fd;
+
+    // Use at least 2 chunks, each between 64 KiB and 1 MiB.
+    ra->chunk_size = MPCLAMP(size / 4, 64 * 1024, 1024 * 1024);
+    ra->chunk_size -= ra->chunk_size % RA_ALIGN;
+    ra->num_chunks = MPMAX(size / ra->chunk_size, 2);
+
+#ifdef O_DIRECT
+    if (direct) {
+        int dfd = open(filename, O_RDONLY | O_DIRECT | O_CLOEXEC | O_BINARY);
+        if (dfd >= 0) {
+            ra->fd = dfd;
+            ra->own_fd = true;
+        } else {
+            MP_WARN(ra, "Can't use direct I/O: %s\n", strerror(errno));
+        }
+    }
+#else
+    if (direct)
+        MP_WARN(ra, "Direct I/O is not supported on this system.\n");
+#endif
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, RA_ALIGN,
+                       (size_t)ra->num_chunks * ra->chunk_size))
+        goto fail;
+    ra->buffer = buffer;
+    ra->chunks = talloc_zero_array(ra, struct ra_chunk, ra->num_chunks);
+
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->wakeup, NULL);
+    if (pthread_create(&ra->thread, NULL, ra_thread, ra)) {
+        pthread_mutex_destroy(&ra->lock);
+        pthread_cond_destroy(&ra->wakeup);
+        goto fail;
+    }
+
+    MP_VERBOSE(ra, "Readahead: %d chunks of %d KiB%s.\n", ra->num_chunks,
+               ra->chunk_size / 1024, ra->own_fd ? ", direct I/O" : "");
+    return ra;
+
+fail:
+    MP_ERR(ra, "Could not start readahead.\n");
+    if (ra->own_fd)
+        close(ra->fd);
+    free(ra->buffer);
+    talloc_free(ra);
+    return NULL;
+}
+
 static int fill_buffer(stream_t *s, char *buffer, int max_len)
 {
     struct priv *p = s->priv;
-    int r = read(p->fd, buffer, max_len);
+    int r = p->ra ? ra_read(p->ra, s->pos, buffer, max_len)
+                  : read(p->fd, buffer, max_len);
     return (r <= 0) ? -1 : r;
 }
 
@@ -63,9 +310,58 @@ static int write_buffer(stream_t *s, char *buffer, int len)
 static int seek(stream_t *s, int64_t newpos)
 {
     struct priv *p = s->priv;
+    if (p->ra)
+        ra_seek(p->ra, newpos);
     return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
 }
 
+static bool can_borrow(stream_t *s, int64_t pos, int len)
+{
+#if HAVE_SYS_MMAN_H
+    struct priv *p = s->priv;
+    if (!p->regular || p->ra || len < MIN_VIEW_SIZE)
+        return false;
+    // Accessing a mapping past the end of the file is fatal.
+    struct stat st;
+    return fstat(p->fd, &st) == 0 && pos + len <= st.st_size;
+#else
+    return false;
+#endif
+}
+
+static void *borrow(stream_t *s, int len, void **handle)
+{
+#if HAVE_SYS_MMAN_H
+    struct priv *p = s->priv;
+    if (!can_borrow(s, s->pos, len))
+        return NULL;
+    int64_t start = s->pos - s->pos % sysconf(_SC_PAGESIZE);
+    size_t size = s->pos - start + len;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, p->fd, start);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (lseek(p->fd, s->pos + len, SEEK_SET) == (off_t)-1) {
+        munmap(map, size);
+        return NULL;
+    }
+    struct file_view *v = talloc_ptrtype(NULL, v);
+    *v = (struct file_view){map, size};
+    *handle = v;
+    return (char *)map + (s->pos - start);
+#else
+    return NULL;
+#endif
+}
+
+static void release_view(stream_t *s, void *handle)
+{
+#if HAVE_SYS_MMAN_H
+    struct file_view *v = handle;
+    munmap(v->map, v->map_size);
+    talloc_free(v);
+#endif
+}
+
 static int control(stream_t *s, int cmd, void *arg)
 {
     struct priv *p = s->priv;
@@ -87,6 +383,8 @@ static int control(stream_t *s, int cmd, void *arg)
 static void s_close(stream_t *s)
 {
     struct priv *p = s->priv;
+    if (p->ra)
+        ra_destroy(p->ra);
     if (p->close && p->fd >= 0)
         close(p->fd);
 }
@@ -159,6 +457,9 @@ static int open_f(stream_t *stream, int mode)
 #endif
         priv->fd = fd;
         priv->close = true;
+#ifndef __MINGW32__
+        priv->regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+#endif
     }
 
     int64_t len = lseek(fd, 0, SEEK_END);
@@ -177,8 +478,20 @@ static int open_f(stream_t *stream, int mode)
 
     MP_VERBOSE(stream, "File size is %" PRId64 " bytes\n", len);
 
+    struct MPOpts *opts = stream->opts;
+    if (mode == STREAM_READ && priv->regular && opts && opts->file_readahead) {
+        priv->ra = ra_create(stream, filename, fd,
+                             opts->file_readahead * 1024LL,
+                             opts->file_direct_io);
+    }
+
     stream->fill_buffer = fill_buffer;
     stream->write_buffer = write_buffer;
+    if (mode == STREAM_READ) {
+        stream->borrow = borrow;
+        stream->release_view = release_view;
+        stream->can_borrow = can_borrow;
+    }
     stream->control = control;
     stream->read_chunk = 64 * 1024;
     stream->close = s_close;
@@ -21,9 +21,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <pthread.h>
 
+#include "talloc.h"
 #include "common/msg.h"
 
 #include "osdep/timer.h"
@@ -56,9 +59,228 @@ const vd_functions_t * const mpcodecs_vd_drivers[] = {
     NULL
 };
 
+// Decoder thread (--vd-queue). The playloop still reads the packets and hands
+// them to the thread, so demuxer seeks don't race with it. Everything that
+// touches decoder state (video_decode(), vd_driver calls) runs on the thread
+// while it exists, or with decode_lock held.
+struct dec_async_packet {
+    struct demux_packet *pkt;
+    int drop_frame;
+    bool eof;
+};
+
+struct dec_async {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_mutex_t decode_lock;
+
+    // Protected by lock.
+    bool terminate;
+    struct dec_async_packet *packets;
+    int num_packets;
+    struct mp_image **frames;
+    int num_frames;
+    int max;                    // limit for both queues
+    bool draining;              // EOF packet taken, flushing the decoder
+    bool eof;                   // decoder fully drained
+    int has_broken_packet_pts;
+
+    // Owned by the playloop thread.
+    bool eof_sent;
+};
+
+static int vd_control(struct dec_video *d_video, int cmd, void *arg)
+{
+    const struct vd_functions *vd = d_video->vd_driver;
+    if (vd)
+        return vd->control(d_video, cmd, arg);
+    return CONTROL_UNKNOWN;
+}
+
+static void *decode_thread(void *pctx)
+{
+    struct dec_video *d_video = pctx;
+    struct dec_async *a = d_video->async;
+
+    pthread_mutex_lock(&a->lock);
+    while (!a->terminate) {
+        if (a->num_frames >= a->max || (!a->draining && !a->num_packets)) {
+            pthread_cond_wait(&a->wakeup, &a->lock);
+            continue;
+        }
+        struct dec_async_packet p = {0};
+        if (!a->draining) {
+            p = a->packets[0];
+            a->num_packets--;
+            memmove(&a->packets[0], &a->packets[1],
+                    a->num_packets * sizeof(a->packets[0]));
+            a->draining = p.eof;
+        }
+        pthread_mutex_unlock(&a->lock);
+
+        pthread_mutex_lock(&a->decode_lock);
+        struct mp_image *mpi = video_decode(d_video, p.pkt, p.drop_frame);
+        int broken_pts = d_video->has_broken_packet_pts;
+        pthread_mutex_unlock(&a->decode_lock);
+        talloc_free(p.pkt);
+
+        pthread_mutex_lock(&a->lock);
+        if (mpi) {
+            a->frames[a->num_frames++] = mpi;
+        } else if (a->draining) {
+            // Decoder returned nothing on a flush call => fully drained.
+            a->draining = false;
+            a->eof = true;
+        }
+        a->has_broken_packet_pts = broken_pts;
+        pthread_cond_broadcast(&a->wakeup);
+        pthread_mutex_unlock(&a->lock);
+
+        if (d_video->wakeup_cb)
+            d_video->wakeup_cb(d_video->wakeup_ctx);
+
+        pthread_mutex_lock(&a->lock);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+static bool start_async(struct dec_video *d_video)
+{
+    struct MPOpts *opts = d_video->opts;
+    if (d_video->async)
+        return true;
+    // Hardware decoders share state with the VO, which is not thread-safe.
+    if (opts->vd_queue < 1 || opts->hwdec_api != 0)
+        return false;
+
+    struct dec_async *a = talloc_zero(NULL, struct dec_async);
+    a->max = opts->vd_queue;
+    a->packets = talloc_array(a, struct dec_async_packet, a->max);
+    a->frames = talloc_array(a, struct mp_image *, a->max);
+    a->has_broken_packet_pts = d_video->has_broken_packet_pts;
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->wakeup, NULL);
+    pthread_mutex_init(&a->decode_lock, NULL);
+    d_video->async = a;
+    if (pthread_create(&a->thread, NULL, decode_thread, d_video)) {
+        MP_ERR(d_video, "Could not start decoder thread.\n");
+        d_video->async = NULL;
+        pthread_mutex_destroy(&a->lock);
+        pthread_cond_destroy(&a->wakeup);
+        pthread_mutex_destroy(&a->decode_lock);
+        talloc_free(a);
+        return false;
+    }
+    MP_VERBOSE(d_video, "Started decoder thread (queue size %d).\n", a->max);
+    return true;
+}
+
+// Stop the thread and discard all queued packets and frames.
+static void stop_async(struct dec_video *d_video)
+{
+    struct dec_async *a = d_video->async;
+    if (!a)
+        return;
+    pthread_mutex_lock(&a->lock);
+    a->terminate = true;
+    pthread_cond_broadcast(&a->wakeup);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->thread, NULL);
+
+    for (int n = 0; n < a->num_packets; n++)
+        talloc_free(a->packets[n].pkt);
+    for (int n = 0; n < a->num_frames; n++)
+        talloc_free(a->frames[n]);
+    d_video->has_broken_packet_pts = a->has_broken_packet_pts;
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->wakeup);
+    pthread_mutex_destroy(&a->decode_lock);
+    talloc_free(a);
+    d_video->async = NULL;
+}
+
+// Whether video_async_send_packet() can be used. Starts the decoder thread if
+// it's enabled and not running yet.
+bool video_async_enabled(struct dec_video *d_video)
+{
+    return start_async(d_video);
+}
+
+// Whether the packet queue has room for another packet.
+bool video_async_can_send(struct dec_video *d_video)
+{
+    struct dec_async *a = d_video->async;
+    pthread_mutex_lock(&a->lock);
+    bool r = !a->eof_sent && a->num_packets < a->max;
+    pthread_mutex_unlock(&a->lock);
+    return r;
+}
+
+// Whether no packets are waiting for the decoder, and no decoded frames are
+// queued, i.e. a packet sent now is the next one to be decoded and displayed.
+bool video_async_is_empty(struct dec_video *d_video)
+{
+    struct dec_async *a = d_video->async;
+    pthread_mutex_lock(&a->lock);
+    bool r = !a->num_packets && !a->num_frames;
+    pthread_mutex_unlock(&a->lock);
+    return r;
+}
+
+// Queue a packet for decoding; takes ownership of pkt. NULL signals EOF, after
+// which the decoder is drained and no more packets are accepted.
+void video_async_send_packet(struct dec_video *d_video,
+                             struct demux_packet *pkt, int drop_frame)
+{
+    struct dec_async *a = d_video->async;
+    pthread_mutex_lock(&a->lock);
+    assert(!a->eof_sent && a->num_packets < a->max);
+    a->packets[a->num_packets++] = (struct dec_async_packet){
+        .pkt = pkt,
+        .drop_frame = drop_frame,
+        .eof = !pkt,
+    };
+    a->eof_sent = !pkt;
+    pthread_cond_broadcast(&a->wakeup);
+    pthread_mutex_unlock(&a->lock);
+}
+
+// Return the next decoded frame, or NULL if none is available yet. *eof is set
+// if no frame will come anymore (EOF was sent and the decoder is drained).
+struct mp_image *video_async_receive_frame(struct dec_video *d_video, bool *eof)
+{
+    struct dec_async *a = d_video->async;
+    struct mp_image *mpi = NULL;
+    pthread_mutex_lock(&a->lock);
+    if (a->num_frames) {
+        mpi = a->frames[0];
+        a->num_frames--;
+        memmove(&a->frames[0], &a->frames[1],
+                a->num_frames * sizeof(a->frames[0]));
+        pthread_cond_broadcast(&a->wakeup);
+    }
+    *eof = !mpi && a->eof;
+    pthread_mutex_unlock(&a->lock);
+    return mpi;
+}
+
+int video_get_broken_packet_pts(struct dec_video *d_video)
+{
+    struct dec_async *a = d_video->async;
+    if (!a)
+        return d_video->has_broken_packet_pts;
+    pthread_mutex_lock(&a->lock);
+    int r = a->has_broken_packet_pts;
+    pthread_mutex_unlock(&a->lock);
+    return r;
+}
+
 void video_reset_decoding(struct dec_video *d_video)
 {
-    video_vd_control(d_video, VDCTRL_RESET, NULL);
+    stop_async(d_video);
+    vd_control(d_video, VDCTRL_RESET, NULL);
     if (d_video->vfilter && d_video->vfilter->initialized == 1)
         vf_seek_reset(d_video->vfilter);
     mp_image_unrefp(&d_video->waiting_decoded_mpi);
@@ -74,10 +296,13 @@ void video_reset_decoding(struct dec_video *d_video)
 
 int video_vd_control(struct dec_video *d_video, int cmd, void *arg)
 {
-    const struct vd_functions *vd = d_video->vd_driver;
-    if (vd)
-        return vd->control(d_video, cmd, arg);
-    return CONTROL_UNKNOWN;
+    struct dec_async *a = d_video->async;
+    if (a)
+        pthread_mutex_lock(&a->decode_lock);
+    int r = vd_control(d_video, cmd, arg);
+    if (a)
+        pthread_mutex_unlock(&a->decode_lock);
+    return r;
 }
 
 int video_set_colors(struct dec_video *d_video, const char *item, int value)
@@ -117,6 +342,7 @@ int video_get_colors(struct dec_video *d_video, const char *item, int *value)
 
 void video_uninit(struct dec_video *d_video)
 {
+    stop_async(d_video);
     mp_image_unrefp(&d_video->waiting_decoded_mpi);
     if (d_video->vd_driver) {
         MP_VERBOSE(d_video, "Uninit video.\n");
@@ -210,7 +436,7 @@ static void add_pts_to_sort(struct dec_video *d_video, double pts)
 {
     if (pts != MP_NOPTS_VALUE) {
         int delay = -1;
-        video_vd_control(d_video, VDCTRL_QUERY_UNSEEN_FRAMES, &delay);
+        vd_control(d_video, VDCTRL_QUERY_UNSEEN_FRAMES, &delay);
         if (delay >= 0 && delay < d_video->num_buffered_pts)
             d_video->num_buffered_pts = delay;
         if (d_video->num_buffered_pts ==
@@ -307,7 +533,7 @@ struct mp_image *video_decode(struct dec_video *d_video,
 
     //------------------------ frame decoded. --------------------
 
-    if (!mpi || drop_frame) {
+    if (!mpi || (drop_frame & ~VD_FLAG_FAST)) {
         talloc_free(mpi);
         return NULL;            // error / skipped frame
     }
@@ -81,6 +81,12 @@ struct dec_video {
 
     // State used only by player/video.c
     double last_pts;
+
+    // Decoder thread state (--vd-queue), or NULL if not running
+    struct dec_async *async;
+    // Called from the decoder thread when a frame was decoded
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
 };
 
 struct mp_decoder_list *video_decoder_list(void);
@@ -93,6 +99,14 @@ struct mp_image *video_decode(struct dec_video *d_video,
                               struct demux_packet *packet,
                               int drop_frame);
 
+bool video_async_enabled(struct dec_video *d_video);
+bool video_async_can_send(struct dec_video *d_video);
+bool video_async_is_empty(struct dec_video *d_video);
+void video_async_send_packet(struct dec_video *d_video,
+                             struct demux_packet *pkt, int drop_frame);
+struct mp_image *video_async_receive_frame(struct dec_video *d_video, bool *eof);
+int video_get_broken_packet_pts(struct dec_video *d_video);
+
 int video_get_colors(struct dec_video *d_video, const char *item, int *value);
 int video_set_colors(struct dec_video *d_video, const char *item, int value);
 void video_reset_decoding(struct dec_video *d_video);
@@ -30,6 +30,8 @@ typedef struct lavc_ctx {
     int do_hw_dr1;
     int best_csp;
     enum AVDiscard skip_frame;
+    enum AVDiscard skip_loop_filter;
+    enum AVDiscard skip_idct;
     const char *software_fallback_decoder;
 
     // From VO
@@ -43,6 +43,7 @@
 
 #include "lavc.h"
 #include "video/decode/dec_video.h"
+#include "video/image_buffer.h"
 
 static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 #define pool_lock() pthread_mutex_lock(&pool_mutex)
@@ -65,11 +66,46 @@ typedef struct FrameBuffer {
 
     int used_by_decoder, needed_by_decoder;
     int refcount;
+    int pooled; // base[0] is from mp_image_buffer_alloc()
     struct FramePool *pool;
     struct FrameBuffer *next;
 } FrameBuffer;
 
 
+// Like av_image_alloc(), but take the memory from the shared image buffer
+// cache. Paletted formats still use av_image_alloc(), which sets up the
+// palette.
+static int image_alloc(FrameBuffer *buf, int w, int h, enum AVPixelFormat fmt)
+{
+    const AVPixFmtDescriptor *desc = &av_pix_fmt_descriptors[fmt];
+    const int align = 32;
+    int ret;
+
+    if (desc->flags & PIX_FMT_PAL)
+        return av_image_alloc(buf->base, buf->linesize, w, h, fmt, align);
+
+    if ((ret = av_image_fill_linesizes(buf->linesize, fmt, FFALIGN(w, 8))) < 0)
+        return ret;
+    for (int i = 0; i < 4; i++)
+        buf->linesize[i] = FFALIGN(buf->linesize[i], align);
+    if ((ret = av_image_fill_pointers(buf->base, fmt, h, NULL, buf->linesize)) < 0)
+        return ret;
+    uint8_t *data = mp_image_buffer_alloc(ret + align);
+    av_image_fill_pointers(buf->base, fmt, h, data, buf->linesize);
+    buf->pooled = 1;
+    return ret;
+}
+
+static void free_buffer(FrameBuffer *buf)
+{
+    if (buf->pooled) {
+        mp_image_buffer_free(buf->base[0]);
+    } else {
+        av_freep(&buf->base[0]);
+    }
+    av_free(buf);
+}
+
 static int alloc_buffer(FramePool *pool, AVCodecContext *s)
 {
     const AVPixFmtDescriptor *desc = &av_pix_fmt_descriptors[s->pix_fmt];
@@ -95,8 +131,7 @@ static int alloc_buffer(FramePool *pool, AVCodecContext *s)
         h += 2*edge;
     }
 
-    if ((ret = av_image_alloc(buf->base, buf->linesize, w, h,
-                              s->pix_fmt, 32)) < 0) {
+    if ((ret = image_alloc(buf, w, h, s->pix_fmt)) < 0) {
         av_freep(&buf);
         av_log(s, AV_LOG_ERROR, "alloc_buffer: av_image_alloc() failed\n");
         return ret;
@@ -159,8 +194,7 @@ int mp_codec_get_buffer(AVCodecContext *s, AVFrame *frame)
     buf = pool->list;
     if (buf->w != s->width || buf->h != s->height || buf->pix_fmt != s->pix_fmt) {
         pool->list = buf->next;
-        av_freep(&buf->base[0]);
-        av_free(buf);
+        free_buffer(buf);
         if ((ret = alloc_buffer(pool, s)) < 0) {
             pool_unlock();
             return ret;
@@ -274,8 +308,7 @@ void mp_buffer_pool_free(struct FramePool **p_pool)
         FrameBuffer *buf = pool->list;
         pool->list = buf->next;
         av_assert0(buf->refcount == 0);
-        av_freep(&buf->base[0]);
-        av_free(buf);
+        free_buffer(buf);
     }
     pool->dead = 1;
     if (pool->refcount == 0)
@@ -41,6 +41,11 @@ typedef struct vd_functions
 // NULL terminated array of all drivers
 extern const vd_functions_t *const mpcodecs_vd_drivers[];
 
+// Flag for vd_functions.decode(), in addition to the framedrop levels 1 and 2:
+// the frame won't be displayed, so decode it as fast as possible, even if
+// that reduces quality.
+#define VD_FLAG_FAST 4
+
 enum vd_ctrl {
     VDCTRL_RESET = 1, // reset decode state after seeking
     VDCTRL_QUERY_UNSEEN_FRAMES, // current decoder lag
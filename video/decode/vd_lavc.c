@@ -38,6 +38,7 @@
 #include "common/av_opts.h"
 #include "common/av_common.h"
 #include "common/codecs.h"
+#include "osdep/numcores.h"
 
 #include "compat/mpbswap.h"
 #include "video/fmt-conversion.h"
@@ -77,7 +78,12 @@ const m_option_t lavc_decode_opts_conf[] = {
     OPT_STRING("skiploopfilter", lavc_param.skip_loop_filter_str, 0),
     OPT_STRING("skipidct", lavc_param.skip_idct_str, 0),
     OPT_STRING("skipframe", lavc_param.skip_frame_str, 0),
-    OPT_INTRANGE("threads", lavc_param.threads, 0, 0, 16),
+    OPT_CHOICE_OR_INT("threads", lavc_param.threads, 0, 0, 16,
+                      ({"auto", -1})),
+    OPT_CHOICE("thread-type", lavc_param.thread_type, 0,
+               ({"auto", 0},
+                {"frame", FF_THREAD_FRAME},
+                {"slice", FF_THREAD_SLICE})),
     OPT_FLAG_CONSTANTS("bitexact", lavc_param.bitexact, 0, 0, CODEC_FLAG_BITEXACT),
     OPT_FLAG("check-hw-profile", lavc_param.check_hw_profile, 0),
     OPT_STRING("o", lavc_param.avopt, 0),
@@ -362,6 +368,73 @@ static void set_from_bih(AVCodecContext *avctx, uint32_t format,
     avctx->coded_height = bih->biHeight;
 }
 
+// Whether the stream is H.264 Baseline, which is typically used for
+// low-latency streaming and never has B-frames.
+static bool is_h264_baseline(AVCodec *codec, struct sh_stream *sh)
+{
+    if (codec->id != AV_CODEC_ID_H264)
+        return false;
+    int profile = FF_PROFILE_UNKNOWN;
+    uint8_t *extradata = NULL;
+    int extradata_size = 0;
+    if (sh->lav_headers) {
+        profile = sh->lav_headers->profile;
+        extradata = sh->lav_headers->extradata;
+        extradata_size = sh->lav_headers->extradata_size;
+    } else if (sh->video->bih) {
+        extradata = (uint8_t *)(sh->video->bih + 1);
+        extradata_size = sh->video->bih->biSize - sizeof(*sh->video->bih);
+    }
+    // avcC header (e.g. from demux_mkv): profile_idc is in the second byte
+    if (profile == FF_PROFILE_UNKNOWN && extradata_size >= 4 &&
+        extradata[0] == 1)
+        profile = extradata[1];
+    return (profile & ~FF_PROFILE_H264_CONSTRAINED) == FF_PROFILE_H264_BASELINE;
+}
+
+// Select thread count and threading mode for software decoding.
+// Frame threading adds thread_count - 1 frames of decoding delay, which has to
+// be paid again after each seek. With --vd-lavc-threads=auto, avoid it where
+// slice threading works as well, and don't use more threads than the frame
+// size justifies.
+static void select_threads(struct dec_video *vd, AVCodec *codec)
+{
+    vd_ffmpeg_ctx *ctx = vd->priv;
+    AVCodecContext *avctx = ctx->avctx;
+    struct lavc_param *lavc_param = &vd->opts->lavc_param;
+    int thread_type = lavc_param->thread_type;
+
+    if (lavc_param->threads >= 0) {
+        mp_set_avcodec_threads(avctx, lavc_param->threads);
+    } else {
+        int cores = default_thread_count();
+        if (cores < 1) {
+            MP_WARN(vd, "Could not determine thread count to use, "
+                    "defaulting to 1.\n");
+            cores = 1;
+        }
+        // Roughly one thread per 320x240 pixels, so that small videos don't
+        // pay for delay and synchronization overhead that buys them nothing.
+        int pixels = vd->header->video->disp_w * vd->header->video->disp_h;
+        int max_threads = pixels > 0 ? MPMAX(pixels / (320 * 240), 1) : cores;
+        avctx->thread_count = MPCLAMP(MPMIN(cores, max_threads), 1, 16);
+
+        if (!thread_type && avctx->thread_count > 1) {
+            const AVCodecDescriptor *desc = avcodec_descriptor_get(codec->id);
+            bool intra_only = desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+            if (!(codec->capabilities & CODEC_CAP_FRAME_THREADS)) {
+                thread_type = FF_THREAD_SLICE;
+            } else if (codec->capabilities & CODEC_CAP_SLICE_THREADS) {
+                if (intra_only || is_h264_baseline(codec, vd->header))
+                    thread_type = FF_THREAD_SLICE;
+            }
+        }
+    }
+
+    if (thread_type)
+        avctx->thread_type = thread_type;
+}
+
 static void init_avctx(struct dec_video *vd, const char *decoder,
                        struct vd_lavc_hwdec *hwdec)
 {
@@ -416,7 +489,6 @@ static void init_avctx(struct dec_video *vd, const char *decoder,
             avctx->release_buffer  = mp_codec_release_buffer;
         }
 #endif
-        mp_set_avcodec_threads(avctx, lavc_param->threads);
     }
 
     avctx->flags |= lavc_param->bitexact;
@@ -435,6 +507,10 @@ static void init_avctx(struct dec_video *vd, const char *decoder,
     avctx->skip_idct = str2AVDiscard(vd, lavc_param->skip_idct_str);
     avctx->skip_frame = str2AVDiscard(vd, lavc_param->skip_frame_str);
 
+    // Before the avopts, so that they can override the thread settings.
+    if (!ctx->hwdec)
+        select_threads(vd, lavc_codec);
+
     if (lavc_param->avopt) {
         if (parse_avopts(avctx, lavc_param->avopt) < 0) {
             MP_ERR(vd, "Your options /%s/ look like gibberish to me pal\n",
@@ -446,6 +522,8 @@ static void init_avctx(struct dec_video *vd, const char *decoder,
 
     // Do this after the above avopt handling in case it changes values
     ctx->skip_frame = avctx->skip_frame;
+    ctx->skip_loop_filter = avctx->skip_loop_filter;
+    ctx->skip_idct = avctx->skip_idct;
 
     avctx->codec_tag = sh->format;
     avctx->coded_width  = sh->video->disp_w;
@@ -472,6 +550,15 @@ static void init_avctx(struct dec_video *vd, const char *decoder,
         uninit_avctx(vd);
         return;
     }
+
+    if (avctx->active_thread_type) {
+        bool frame = avctx->active_thread_type & FF_THREAD_FRAME;
+        int delay = frame ? avctx->thread_count - 1 : 0;
+        MP_VERBOSE(vd, "Using %d threads (%s threading), adding %d frames "
+                   "(%.0f ms) of decoding latency.\n", avctx->thread_count,
+                   frame ? "frame" : "slice", delay,
+                   vd->fps > 0 ? delay * 1000 / vd->fps : 0);
+    }
 }
 
 static void uninit_avctx(struct dec_video *vd)
@@ -744,6 +831,16 @@ static int decode(struct dec_video *vd, struct demux_packet *packet,
     else
         avctx->skip_frame = ctx->skip_frame;
 
+    // Skipping the loop filter on reference frames degrades the frames
+    // predicted from them, so keep it at least for keyframes. Skipping the
+    // IDCT is only valid for frames nothing else refers to.
+    avctx->skip_loop_filter = ctx->skip_loop_filter;
+    avctx->skip_idct = ctx->skip_idct;
+    if (flags & VD_FLAG_FAST) {
+        avctx->skip_loop_filter = MPMAX(ctx->skip_loop_filter, AVDISCARD_NONKEY);
+        avctx->skip_idct = MPMAX(ctx->skip_idct, AVDISCARD_NONREF);
+    }
+
     mp_set_av_packet(&pkt, packet, NULL);
 
     ret = avcodec_decode_video2(avctx, ctx->pic, &got_picture, &pkt);
@@ -0,0 +1,259 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <libavutil/mem.h>
+
+#include "osdep/timer.h"
+#include "image_buffer.h"
+
+// Size classes go from 1 << MIN_SHIFT to 1 << MAX_SHIFT bytes, with 4 classes
+// per power of 2 (so at most 25% of a buffer is wasted). Larger buffers are
+// allocated exactly and never cached.
+#define MIN_SHIFT 12
+#define MAX_SHIFT 28
+#define NUM_CLASSES ((MAX_SHIFT - MIN_SHIFT) * 4 + 1)
+
+// Cached buffers unused for this long are released.
+#define IDLE_TIME_US (10 * 1000 * 1000)
+// How often the free lists are checked for idle buffers.
+#define TRIM_INTERVAL_US (1000 * 1000)
+
+// Buffers of at least this size are mapped separately with huge pages enabled.
+#define HUGE_PAGE_MIN (2 * 1024 * 1024)
+
+// Placed in front of each buffer. HEADER_SIZE keeps the buffer as aligned as
+// the av_malloc() result.
+struct buffer_block {
+    size_t capacity;
+    size_t map_size;            // if mmap()ed, size of the mapping, else 0
+    int64_t idle_since;         // while on a free list
+    struct buffer_block *next;
+};
+#define HEADER_SIZE 64
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct buffer_block *free_lists[NUM_CLASSES];
+static struct mp_image_buffer_stats pool_stats;
+static int64_t pool_max_bytes = 128 * 1024 * 1024;
+static bool pool_huge_pages;
+static int64_t last_trim;
+
+static size_t class_size(int c)
+{
+    return (size_t)(4 + c % 4) << (MIN_SHIFT - 2 + c / 4);
+}
+
+// Return the smallest class that can hold size bytes, or -1 if too large.
+static int size_to_class(size_t size)
+{
+    if (size <= ((size_t)1 << MIN_SHIFT))
+        return 0;
+    if (size > ((size_t)1 << MAX_SHIFT))
+        return -1;
+    int b = 0; // 1 << b < size <= 1 << (b + 1)
+    while (((size_t)2 << b) < size)
+        b++;
+    size_t step = (size_t)1 << (b - 2);
+    int k = (size - ((size_t)1 << b) + step - 1) / step;
+    return (b - MIN_SHIFT) * 4 + k;
+}
+
+static struct buffer_block *get_block(void *buf)
+{
+    return (struct buffer_block *)((char *)buf - HEADER_SIZE);
+}
+
+static struct buffer_block *new_block(size_t capacity, bool huge_pages)
+{
+    struct buffer_block *block = NULL;
+#if HAVE_SYS_MMAN_H && defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+    if (huge_pages && capacity >= HUGE_PAGE_MIN) {
+        size_t map_size = HEADER_SIZE + capacity;
+        void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, map_size, MADV_HUGEPAGE);
+            block = p;
+            block->map_size = map_size;
+        }
+    }
+#endif
+    if (!block) {
+        block = av_malloc(HEADER_SIZE + capacity);
+        if (!block) {
+            fprintf(stderr, "Memory allocation failure!\n");
+            abort();
+        }
+        block->map_size = 0;
+    }
+    block->capacity = capacity;
+    return block;
+}
+
+static void release_blocks(struct buffer_block *list)
+{
+    while (list) {
+        struct buffer_block *block = list;
+        list = block->next;
+#if HAVE_SYS_MMAN_H
+        if (block->map_size) {
+            munmap(block, block->map_size);
+            continue;
+        }
+#endif
+        av_free(block);
+    }
+}
+
+// Unlink buffers that were idle for too long, and return them as a list.
+// Must be called with pool_lock held.
+static struct buffer_block *trim_idle(void)
+{
+    int64_t now = mp_time_us();
+    if (now - last_trim < TRIM_INTERVAL_US)
+        return NULL;
+    last_trim = now;
+
+    struct buffer_block *dead = NULL;
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        struct buffer_block **prev = &free_lists[c];
+        while (*prev) {
+            struct buffer_block *block = *prev;
+            if (now - block->idle_since >= IDLE_TIME_US) {
+                *prev = block->next;
+                block->next = dead;
+                dead = block;
+                pool_stats.cached_bytes -= block->capacity;
+                pool_stats.cached_buffers--;
+            } else {
+                prev = &block->next;
+            }
+        }
+    }
+    return dead;
+}
+
+void *mp_image_buffer_alloc(size_t size)
+{
+    int c = size_to_class(size);
+    size_t capacity = c >= 0 ? class_size(c) : size;
+    struct buffer_block *block = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_stats.allocs++;
+    pool_stats.used_bytes += capacity;
+    if (c >= 0 && free_lists[c]) {
+        block = free_lists[c];
+        free_lists[c] = block->next;
+        pool_stats.hits++;
+        pool_stats.cached_bytes -= capacity;
+        pool_stats.cached_buffers--;
+    }
+    bool huge_pages = pool_huge_pages;
+    struct buffer_block *dead = trim_idle();
+    pthread_mutex_unlock(&pool_lock);
+
+    release_blocks(dead);
+
+    if (!block)
+        block = new_block(capacity, huge_pages);
+    block->next = NULL;
+    return (char *)block + HEADER_SIZE;
+}
+
+void mp_image_buffer_free(void *buf)
+{
+    if (!buf)
+        return;
+    struct buffer_block *block = get_block(buf);
+    int c = size_to_class(block->capacity);
+
+    pthread_mutex_lock(&pool_lock);
+    pool_stats.frees++;
+    pool_stats.used_bytes -= block->capacity;
+    if (c >= 0 && class_size(c) == block->capacity &&
+        pool_stats.cached_bytes + block->capacity <= pool_max_bytes)
+    {
+        block->idle_since = mp_time_us();
+        block->next = free_lists[c];
+        free_lists[c] = block;
+        pool_stats.cached_bytes += block->capacity;
+        pool_stats.cached_buffers++;
+        block = NULL;
+    } else {
+        pool_stats.discards++;
+    }
+    struct buffer_block *dead = trim_idle();
+    pthread_mutex_unlock(&pool_lock);
+
+    if (block) {
+        block->next = dead;
+        dead = block;
+    }
+    release_blocks(dead);
+}
+
+void mp_image_buffer_set_config(int64_t max_bytes, bool huge_pages)
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_max_bytes = max_bytes;
+    pool_huge_pages = huge_pages;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void mp_image_buffer_get_stats(struct mp_image_buffer_stats *stats)
+{
+    pthread_mutex_lock(&pool_lock);
+    *stats = pool_stats;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void mp_image_buffer_trim(void)
+{
+    pthread_mutex_lock(&pool_lock);
+    struct buffer_block *dead = trim_idle();
+    pthread_mutex_unlock(&pool_lock);
+    release_blocks(dead);
+}
+
+void mp_image_buffer_flush(void)
+{
+    struct buffer_block *dead = NULL;
+    pthread_mutex_lock(&pool_lock);
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        while (free_lists[c]) {
+            struct buffer_block *block = free_lists[c];
+            free_lists[c] = block->next;
+            block->next = dead;
+            dead = block;
+        }
+    }
+    pool_stats.cached_bytes = 0;
+    pool_stats.cached_buffers = 0;
+    pthread_mutex_unlock(&pool_lock);
+    release_blocks(dead);
+}
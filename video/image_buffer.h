@@ -0,0 +1,59 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPV_IMAGE_BUFFER_H
+#define MPV_IMAGE_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Process-wide cache of image data buffers, shared by mp_image_alloc() (and
+// thus all mp_image_pools) and the libavcodec DR1 code. Freed buffers are kept
+// on per-size-class free lists, so that reallocating frames after a reconfig
+// or in a different pool doesn't go through the system allocator again.
+// Buffers that stay unused for a while are released. All functions are
+// thread-safe.
+
+struct mp_image_buffer_stats {
+    int64_t allocs;         // mp_image_buffer_alloc() calls
+    int64_t hits;           // allocations served from a free list
+    int64_t frees;          // mp_image_buffer_free() calls
+    int64_t discards;       // freed buffers released instead of cached
+    int64_t cached_bytes;   // memory currently held on the free lists
+    int64_t cached_buffers;
+    int64_t used_bytes;     // memory in buffers currently allocated
+};
+
+// Return a buffer with at least size bytes, aligned like av_malloc(). Never
+// returns NULL.
+void *mp_image_buffer_alloc(size_t size);
+void mp_image_buffer_free(void *buf);
+
+// max_bytes: maximum memory kept on the free lists
+// huge_pages: try to use transparent huge pages for large buffers
+void mp_image_buffer_set_config(int64_t max_bytes, bool huge_pages);
+
+void mp_image_buffer_get_stats(struct mp_image_buffer_stats *stats);
+// Release buffers that were unused for a while. This also happens on
+// allocation and free, but must be called periodically if there is no video
+// activity (cheap if there's nothing to do).
+void mp_image_buffer_trim(void);
+// Release all cached buffers.
+void mp_image_buffer_flush(void);
+
+#endif /* MPV_IMAGE_BUFFER_H */
@@ -21,7 +21,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
 #include <assert.h>
 
 #include <libavutil/mem.h>
@@ -31,7 +30,9 @@
 
 #include "talloc.h"
 
+#include "compat/atomics.h"
 #include "img_format.h"
+#include "image_buffer.h"
 #include "mp_image.h"
 #include "sws_utils.h"
 #include "memcpy_pic.h"
@@ -39,10 +40,6 @@
 
 #include "video/filter/vf.h"
 
-static pthread_mutex_t refcount_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define refcount_lock() pthread_mutex_lock(&refcount_mutex)
-#define refcount_unlock() pthread_mutex_unlock(&refcount_mutex)
-
 struct m_refcount {
     void *arg;
     // free() is called if refcount reaches 0.
@@ -55,6 +52,7 @@ struct m_refcount {
     void (*ext_unref)(void *arg);
     bool (*ext_is_unique)(void *arg);
     // Native refcount (there may be additional references if .ext_* are set)
+    // Only accessed with atomic operations.
     int refcount;
 };
 
@@ -76,9 +74,7 @@ static struct m_refcount *m_refcount_new(void)
 
 static void m_refcount_ref(struct m_refcount *ref)
 {
-    refcount_lock();
-    ref->refcount++;
-    refcount_unlock();
+    mp_atomic_add_and_fetch(&ref->refcount, 1);
 
     if (ref->ext_ref)
         ref->ext_ref(ref->arg);
@@ -89,14 +85,10 @@ static void m_refcount_unref(struct m_refcount *ref)
     if (ref->ext_unref)
         ref->ext_unref(ref->arg);
 
-    bool dead;
-    refcount_lock();
-    assert(ref->refcount > 0);
-    ref->refcount--;
-    dead = ref->refcount == 0;
-    refcount_unlock();
+    int refcount = mp_atomic_add_and_fetch(&ref->refcount, -1);
+    assert(refcount >= 0);
 
-    if (dead) {
+    if (refcount == 0) {
         if (ref->free)
             ref->free(ref->arg);
         talloc_free(ref);
@@ -105,12 +97,8 @@ static void m_refcount_unref(struct m_refcount *ref)
 
 static bool m_refcount_is_unique(struct m_refcount *ref)
 {
-    bool nonunique;
-    refcount_lock();
-    nonunique = ref->refcount > 1;
-    refcount_unlock();
-
-    if (nonunique)
+    mp_memory_barrier();
+    if (ref->refcount > 1)
         return false;
     if (ref->ext_is_unique)
         return ref->ext_is_unique(ref->arg); // referenced only by us
@@ -139,9 +127,7 @@ static void mp_image_alloc_planes(struct mp_image *mpi)
     for (int n = 0; n < MP_MAX_PLANES; n++)
         sum += plane_size[n];
 
-    uint8_t *data = av_malloc(FFMAX(sum, 1));
-    if (!data)
-        abort(); //out of memory
+    uint8_t *data = mp_image_buffer_alloc(FFMAX(sum, 1));
 
     for (int n = 0; n < MP_MAX_PLANES; n++) {
         mpi->planes[n] = plane_size[n] ? data : NULL;
@@ -200,7 +186,7 @@ struct mp_image *mp_image_alloc(unsigned int imgfmt, int w, int h)
     mp_image_alloc_planes(mpi);
 
     mpi->refcount = m_refcount_new();
-    mpi->refcount->free = av_free;
+    mpi->refcount->free = mp_image_buffer_free;
     mpi->refcount->arg = mpi->planes[0];
     return mpi;
 }
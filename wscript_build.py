@@ -193,6 +193,7 @@ def build(ctx):
         ( "demux/demux_subreader.c" ),
         ( "demux/ebml.c" ),
         ( "demux/mf.c" ),
+        ( "demux/packet_pool.c" ),
 
         ## Input
         ( "input/cmd_list.c" ),
@@ -240,6 +241,7 @@ def build(ctx):
         ( "stream/ai_sndio.c",                   "sndio" ),
         ( "stream/audio_in.c",                   "audio-input" ),
         ( "stream/cache.c" ),
+        ( "stream/cache_store.c" ),
         ( "stream/cdinfo.c",                     "cdda"),
         ( "stream/cookies.c" ),
         ( "stream/dvb_tune.c",                   "dvbin" ),
@@ -293,6 +295,7 @@ def build(ctx):
         ## Video
         ( "video/csputils.c" ),
         ( "video/fmt-conversion.c" ),
+        ( "video/image_buffer.c" ),
         ( "video/image_writer.c" ),
         ( "video/img_format.c" ),
         ( "video/mp_image.c" ),